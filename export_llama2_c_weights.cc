@@ -1,5 +1,12 @@
 // Copied from original_llama2_run.c to export the weights from .bin files.
+//
+// Usage: export_llama2_c_weights <out_dir> <model.bin>...
+//
+// Write the configs of all models to <out_dir>/models.h, and the weights of
+// each model to <out_dir>/<model>_weights.cc, which also has the classifier
+// weights when the model does not share them with the token embedding table.
 
+#include <cctype>
 #include <string>
 #include <vector>
 
@@ -24,68 +31,124 @@ std::vector<float> ReadFloats(FILE* file, size_t count) {
   return floats;
 }
 
-void WriteFloats(std::string_view filename, const std::vector<float>& floats) {
-  FILE* out = fopen(filename.data(), "w");
-  for (float f : floats)
-    fprintf(out, "%f, ", f);
-  fprintf(out, "\n");
-  fclose(out);
+// The name of model without directory and extension, i.e. "stories15M".
+std::string GetModelName(const std::string& bin) {
+  size_t start = bin.find_last_of("/\\");
+  start = start == std::string::npos ? 0 : start + 1;
+  size_t end = bin.find_last_of('.');
+  if (end != std::string::npos && end < start)
+    end = std::string::npos;
+  return bin.substr(start, end == std::string::npos ? end : end - start);
+}
+
+// Convert the model name to a class name, i.e. "stories-15M" to "Stories15M".
+std::string GetClassName(const std::string& name) {
+  std::string result;
+  bool upper = true;
+  for (char c : name) {
+    if (!isalnum(static_cast<unsigned char>(c))) {
+      upper = true;
+      continue;
+    }
+    result += upper ? static_cast<char>(toupper(c)) : c;
+    upper = false;
+  }
+  if (result.empty() || isdigit(static_cast<unsigned char>(result[0])))
+    result = "Model" + result;
+  return result;
 }
 
 int main(int argc, const char* argv[]) {
-  if (argc != 3)
+  if (argc < 3)
     return 1;
 
-  std::string bin = argv[1];
-  std::string dir = argv[2];
-  FILE* file = fopen(bin.c_str(), "rb");
+  std::string dir = argv[1];
+  FILE* models_h = fopen((dir + "/models.h").c_str(), "w");
+  fprintf(models_h, "// Generated by export_llama2_c_weights, do not edit.\n\n"
+                    "#pragma once\n\n"
+                    "#include <array>\n\n"
+                    "#include \"src/model_config.h\"\n");
+
+  std::vector<std::string> class_names;
+  for (int i = 2; i < argc; ++i) {
+    std::string bin = argv[i];
+    FILE* file = fopen(bin.c_str(), "rb");
+    if (!file)
+      return 2;
 
-  Config config;
-  if (fread(&config, sizeof(Config), 1, file) != 1)
-    return 2;
+    Config config;
+    if (fread(&config, sizeof(Config), 1, file) != 1)
+      return 2;
+    // A negative vocabulary size means the classifier has its own weights.
+    bool shared_classifier = config.vocab_size > 0;
+    config.vocab_size = abs(config.vocab_size);
 
-  FILE* config_h = fopen((dir + "/model_config.h").c_str(), "w");
-  fprintf(config_h, "constexpr int kHiddenDim = %d;\n", config.hidden_dim);
-  fprintf(config_h, "constexpr int kLayersSize = %d;\n", config.n_layers);
-  fprintf(config_h, "constexpr int kHeadsSize = %d;\n", config.n_heads);
-  fprintf(config_h, "constexpr int kKVHeadsSize = %d;\n", config.n_kv_heads);
-  fprintf(config_h, "constexpr int kEmbeddingSize = %d;\n", config.dim);
-  fprintf(config_h, "constexpr int kSequenceSize = %d;\n", config.seq_len);
-  fprintf(config_h, "constexpr int kTokensSize = %d;\n", config.vocab_size);
-  fclose(config_h);
+    std::string name = GetModelName(bin);
+    std::string class_name = GetClassName(name);
+    class_names.push_back(class_name);
+    fprintf(models_h, "\n// Exported from %s.\n", bin.c_str());
+    fprintf(models_h, "struct %s : ModelConfig<%d, %d, %d, %d, %d, %d, %d> {\n",
+            class_name.c_str(), config.dim, config.hidden_dim,
+            config.n_layers, config.n_heads, config.n_kv_heads,
+            config.vocab_size, config.seq_len);
+    fprintf(models_h, "  static constexpr const char* kName = \"%s\";\n",
+            name.c_str());
+    fprintf(models_h, "  static const std::array<float, kWeightsSize> "
+                      "kWeights;\n");
+    if (!shared_classifier) {
+      fprintf(models_h, "  static constexpr bool kSharedClassifier = false;\n");
+      fprintf(models_h, "  static const std::array<float, kClassifierSize> "
+                        "kClassifierWeights;\n");
+    }
+    fprintf(models_h, "};\n");
 
-  int head_dimension = config.dim / config.n_heads;
+    // The weights are written in the same layout with the .bin file, see
+    // src/model_weights.h for details.
+    int head_dimension = config.dim / config.n_heads;
+    size_t layer_size =
+        2 * config.dim +
+        config.dim * config.n_heads * head_dimension +
+        2 * config.dim * config.n_kv_heads * head_dimension +
+        config.dim * config.dim +
+        3 * config.dim * config.hidden_dim;
+    size_t size = static_cast<size_t>(config.vocab_size) * config.dim +
+                  config.n_layers * layer_size + config.dim;
+    std::vector<float> floats = ReadFloats(file, size);
+    std::vector<float> classifier;
+    if (!shared_classifier) {
+      // Skip the RoPE frequencies which are computed at runtime.
+      ReadFloats(file, static_cast<size_t>(config.seq_len) * head_dimension);
+      classifier = ReadFloats(file,
+                              static_cast<size_t>(config.vocab_size) *
+                              config.dim);
+    }
+    fclose(file);
 
-  WriteFloats(dir + "/token_embedding_table.inc",
-              ReadFloats(file, config.vocab_size * config.dim));
-  WriteFloats(dir + "/rms_att_weight.inc",
-              ReadFloats(file, config.n_layers * config.dim));
-  WriteFloats(dir + "/wq.inc",
-              ReadFloats(file, config.n_layers * config.dim *
-                               config.n_heads * head_dimension));
-  WriteFloats(dir + "/wk.inc",
-              ReadFloats(file, config.n_layers * config.dim *
-                               config.n_kv_heads * head_dimension));
-  WriteFloats(dir + "/wv.inc",
-              ReadFloats(file, config.n_layers * config.dim *
-                               config.n_kv_heads * head_dimension));
-  WriteFloats(dir + "/wo.inc",
-              ReadFloats(file, config.n_layers * config.dim * config.dim));
-  WriteFloats(dir + "/rms_ffn_weight.inc",
-              ReadFloats(file, config.n_layers * config.dim));
-  WriteFloats(dir + "/w1.inc",
-              ReadFloats(file, config.n_layers *
-                               config.dim * config.hidden_dim));
-  WriteFloats(dir + "/w2.inc",
-              ReadFloats(file, config.n_layers *
-                               config.hidden_dim * config.dim));
-  WriteFloats(dir + "/w3.inc",
-              ReadFloats(file, config.n_layers *
-                               config.dim * config.hidden_dim));
-  WriteFloats(dir + "/rms_out_weight.inc",
-              ReadFloats(file, config.dim));
+    FILE* out = fopen((dir + "/" + name + "_weights.cc").c_str(), "w");
+    fprintf(out, "// Generated by export_llama2_c_weights, do not edit.\n\n"
+                 "#include \"models.h\"\n\n");
+    fprintf(out, "const std::array<float, %s::kWeightsSize> %s::kWeights = {\n",
+            class_name.c_str(), class_name.c_str());
+    for (float f : floats)
+      fprintf(out, "%f, ", f);
+    fprintf(out, "\n};\n");
+    if (!shared_classifier) {
+      fprintf(out, "\nconst std::array<float, %s::kClassifierSize> "
+                   "%s::kClassifierWeights = {\n",
+              class_name.c_str(), class_name.c_str());
+      for (float f : classifier)
+        fprintf(out, "%f, ", f);
+      fprintf(out, "\n};\n");
+    }
+    fclose(out);
+  }
 
-  fclose(file);
+  // Call V(Model) for each model, which is used for instantiating templates.
+  fprintf(models_h, "\n#define FROST_FOR_EACH_MODEL(V)");
+  for (const std::string& class_name : class_names)
+    fprintf(models_h, " \\\n  V(%s)", class_name.c_str());
+  fprintf(models_h, "\n");
+  fclose(models_h);
 
   return 0;
 }
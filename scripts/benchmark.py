@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+
+# Run the end-to-end benchmark of frost_run, and the same prompts with
+# original_llama2_run as baseline, then print the results as JSON.
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+
+from bootstrap import ROOT_DIR, current_os
+
+def run_frost(args):
+  frost_run = os.path.join(args.out_dir, 'frost_run')
+  command = [ frost_run, '-m', 'benchmark', '-w', args.weights,
+              '-n', str(args.steps), '-s', str(args.seed), '-p', str(args.top_p) ]
+  if args.prompt is not None:
+    command += [ '-i', args.prompt ]
+  result = subprocess.run(command, cwd=ROOT_DIR, check=True,
+                          stdout=subprocess.PIPE)
+  return json.loads(result.stdout)
+
+def run_llama2_c(args, frost_runs):
+  original = os.path.join(args.out_dir, 'original_llama2_run')
+  runs = []
+  for frost_run in frost_runs:
+    prompt = frost_run['prompt']
+    # The steps of llama2.c include the prompt tokens, and its achieved tok/s
+    # counts them too, so it is an overall rate instead of a decode rate.
+    steps = frost_run['prompt_tokens'] + args.steps
+    command = [ original, args.weights, '-n', str(steps), '-s', str(args.seed),
+                '-p', str(args.top_p), '-z', 'assets/tokenizer.bin',
+                '-i', prompt ]
+    start = time.monotonic()
+    process = subprocess.Popen(command, cwd=ROOT_DIR,
+                               stdout=subprocess.DEVNULL,
+                               stderr=subprocess.PIPE)
+    _, status, usage = os.wait4(process.pid, 0)
+    elapsed = time.monotonic() - start
+    stderr = process.stderr.read().decode()
+    if os.waitstatus_to_exitcode(status) != 0:
+      raise RuntimeError(f'original_llama2_run failed: {stderr}')
+    match = re.search(r'achieved tok/s: ([0-9.]+)', stderr)
+    runs.append({
+      'prompt': prompt,
+      'steps': steps,
+      'overall_tok_s': float(match.group(1)) if match else None,
+      'wall_ms': elapsed * 1e3,
+      # ru_maxrss is in KB on Linux.
+      'peak_rss_mb': usage.ru_maxrss / 1e3,
+    })
+  return { 'runs': runs }
+
+def main():
+  parser = argparse.ArgumentParser()
+  parser.add_argument('-C', dest='out_dir', default='out/Release',
+                      help='Which config to run')
+  parser.add_argument('--weights', default='stories15M.bin',
+                      help='Path to model weights, run by both frost_run '
+                           'and original_llama2_run')
+  parser.add_argument('--prompt', default=None,
+                      help='The prompt, default to a fixed set of prompts')
+  parser.add_argument('--steps', type=int, default=256,
+                      help='Number of tokens to generate')
+  parser.add_argument('--seed', type=int, default=42)
+  parser.add_argument('--top-p', type=float, default=0.9)
+  parser.add_argument('--no-baseline', action='store_true',
+                      help='Do not run original_llama2_run')
+  args = parser.parse_args()
+
+  results = { 'frost': run_frost(args) }
+  if not args.no_baseline and current_os() != 'win':
+    results['llama2_c'] = run_llama2_c(args, results['frost']['runs'])
+  json.dump(results, sys.stdout, indent=2)
+  print()
+
+if __name__ == '__main__':
+  exit(main())
@@ -40,6 +40,8 @@ def download_and_extract(url, dest_dir):
 def main():
   parser = argparse.ArgumentParser()
   parser.add_argument('--weights', default=None, help='Path to model weights')
+  parser.add_argument('--extra-weights', nargs='*', default=[],
+                      help='Paths to weights of more models to compile in')
   args = parser.parse_args()
 
   # Download weights if not specified.
@@ -62,8 +64,10 @@ def main():
                      os.path.join(gn_dir, 'tools/clang/scripts/update.py') ])
 
   # Generate ninja files.
+  extra_models = ', '.join(f'"//{w}"' for w in args.extra_weights)
   gn_args = [
     f'llama2_c_weigets="//{weights}"',
+    f'frost_extra_models=[{extra_models}]',
     'is_component_build=false',
     'is_debug=false',
     'is_official_build=true',
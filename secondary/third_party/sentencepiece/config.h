@@ -1,9 +0,0 @@
-#ifndef CONFIG_H_
-#define CONFIG_H_
-
-#define VERSION "0.2.0"
-#define PACKAGE "sentencepiece"
-#define PACKAGE_STRING "sentencepiece"
-
-
-#endif  // CONFIG_H_
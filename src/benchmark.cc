@@ -0,0 +1,252 @@
+#include "src/benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "src/engine.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double Milliseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Return the peak resident set size of current process in MB.
+double PeakRSS() {
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.PeakWorkingSetSize / 1e6;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#if defined(__APPLE__)
+  return usage.ru_maxrss / 1e6;  // bytes
+#else
+  return usage.ru_maxrss / 1e3;  // kilobytes
+#endif
+#endif
+}
+
+// Return the element at |percentile| of sorted |values|.
+double Percentile(const std::vector<double>& values, double percentile) {
+  if (values.empty())
+    return 0;
+  size_t index = percentile / 100 * (values.size() - 1) + 0.5;
+  return values[std::min(index, values.size() - 1)];
+}
+
+std::string EscapeJSON(std::string_view str) {
+  std::string result;
+  for (char c : str) {
+    switch (c) {
+      case '"': result += "\\\""; break;
+      case '\\': result += "\\\\"; break;
+      case '\n': result += "\\n"; break;
+      case '\t': result += "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char buffer[8];
+          snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+          result += buffer;
+        } else {
+          result += c;
+        }
+    }
+  }
+  return result;
+}
+
+// The timing of generating tokens for one prompt.
+struct Run {
+  size_t generated = 0;
+  double ttft_ms = 0;
+  double prefill_ms = 0;
+  double decode_ms = 0;
+  std::vector<double> intervals;
+};
+
+// Generate a fixed number of tokens after |tokens|, EOS does not stop the
+// benchmark. When |speculative| each pass of the model verifies the drafts.
+Run Generate(Engine* engine,
+             const BenchmarkOptions& options,
+             const std::vector<int>& tokens,
+             bool speculative) {
+  size_t max_position = engine->model().shape().sequence_size;
+  engine->Reset();
+  engine->Seed(options.seed);
+
+  auto start_time = Clock::now();
+  engine->Prefill(tokens);
+  auto prefill_time = Clock::now();
+
+  Run run;
+  auto first_token_time = prefill_time;
+  auto last_time = prefill_time;
+  // The tokens sampled from the model, only the last one has not been fed.
+  std::vector<int> pending(1, engine->Sample(options.top_p));
+  size_t next = 0;
+  int previous = engine->last_token();
+  while (true) {
+    int token = pending[next++];
+    engine->Decode(previous, token);
+    previous = token;
+    auto now = Clock::now();
+    if (run.generated == 0)
+      first_token_time = now;
+    else
+      run.intervals.push_back(Milliseconds(now - last_time));
+    last_time = now;
+    run.generated++;
+    if (run.generated >= options.steps)
+      break;
+    if (next < pending.size())
+      continue;
+    if (engine->position() == max_position)
+      break;
+    if (speculative) {
+      engine->Speculate(token, options.top_p, &pending);
+    } else {
+      engine->Step(token);
+      pending.assign(1, engine->Sample(options.top_p));
+    }
+    next = 0;
+  }
+
+  run.ttft_ms = Milliseconds(first_token_time - start_time);
+  run.prefill_ms = Milliseconds(prefill_time - start_time);
+  run.decode_ms = Milliseconds(last_time - first_token_time);
+  std::sort(run.intervals.begin(), run.intervals.end());
+  return run;
+}
+
+double DecodeTokensPerSecond(const Run& run) {
+  return run.decode_ms > 0 ? run.intervals.size() / run.decode_ms * 1e3 : 0;
+}
+
+}  // namespace
+
+int RunBenchmark(const BenchmarkOptions& options) {
+  auto load_start = Clock::now();
+  std::string error;
+  std::unique_ptr<Engine> engine = Engine::Create(options.model,
+                                                  options.tokenizer_path,
+                                                  &error);
+  if (!engine) {
+    std::cerr << error << std::endl;
+    return 2;
+  }
+  if (!options.draft_model.empty() &&
+      !engine->UseDraftModel(options.draft_model, options.max_draft, &error)) {
+    std::cerr << error << std::endl;
+    return 2;
+  }
+  if (options.layer_streaming && !engine->EnableLayerStreaming()) {
+    std::cerr << "Layer streaming requires a checkpoint file." << std::endl;
+    return 2;
+  }
+  engine->EnablePipeline(options.pipeline_stages, options.pipeline_cpus);
+  double load_ms = Milliseconds(Clock::now() - load_start);
+
+  const ModelShape& shape = engine->model().shape();
+  size_t max_position = shape.sequence_size;
+  for (const std::string& prompt : options.prompts) {
+    if (engine->Tokenize(prompt, true).size() > max_position) {
+      std::cerr << "The prompt is longer than the sequence of the model."
+                << std::endl;
+      return 2;
+    }
+  }
+  std::cout << "{\n"
+            << "  \"model\": {\"name\": \"" << engine->model().name() << "\""
+            << ", \"dim\": " << shape.embedding_size
+            << ", \"hidden_dim\": " << shape.hidden_dim
+            << ", \"n_layers\": " << shape.layers_size
+            << ", \"n_heads\": " << shape.heads_size
+            << ", \"n_kv_heads\": " << shape.kv_heads_size
+            << ", \"vocab_size\": " << shape.tokens_size
+            << ", \"seq_len\": " << shape.sequence_size << "},\n"
+            << "  \"seed\": " << options.seed << ",\n"
+            << "  \"draft_model\": \"" << EscapeJSON(options.draft_model)
+            << "\",\n"
+            << "  \"max_draft\": " << options.max_draft << ",\n"
+            << "  \"layer_streaming\": "
+            << (options.layer_streaming ? "true" : "false") << ",\n"
+            << "  \"pipeline_stages\": " << options.pipeline_stages << ",\n"
+            << "  \"pipeline_cpus\": [";
+  for (size_t i = 0; i < options.pipeline_cpus.size(); ++i)
+    std::cout << (i ? ", " : "") << options.pipeline_cpus[i];
+  std::cout << "],\n"
+            << "  \"top_p\": " << options.top_p << ",\n"
+            << "  \"load_ms\": " << load_ms << ",\n"
+            << "  \"runs\": [";
+
+  // Discard a run of the first prompt, so the page faults of the weights and
+  // the first touch of buffers are not counted in the first timed run. The
+  // draft model is warmed up too, otherwise the speedup of the first prompt
+  // compares a warm baseline with a cold speculative run.
+  if (!options.prompts.empty()) {
+    std::vector<int> tokens = engine->Tokenize(options.prompts[0], true);
+    CHECK_LE(tokens.size(), max_position);
+    Generate(engine.get(), options, tokens, false);
+    if (engine->speculative())
+      Generate(engine.get(), options, tokens, true);
+  }
+
+  for (size_t i = 0; i < options.prompts.size(); ++i) {
+    const std::string& prompt = options.prompts[i];
+    std::vector<int> tokens = engine->Tokenize(prompt, true);
+    CHECK_LE(tokens.size(), max_position);
+
+    Run run = Generate(engine.get(), options, tokens, false);
+    std::cout << (i == 0 ? "\n" : ",\n")
+              << "    {\"prompt\": \"" << EscapeJSON(prompt) << "\""
+              << ", \"prompt_tokens\": " << tokens.size()
+              << ", \"generated_tokens\": " << run.generated
+              << ", \"ttft_ms\": " << run.ttft_ms
+              << ", \"prefill_tok_s\": "
+              << tokens.size() / run.prefill_ms * 1e3
+              << ", \"decode_tok_s\": " << DecodeTokensPerSecond(run)
+              << ", \"itl_ms\": {\"p50\": " << Percentile(run.intervals, 50)
+              << ", \"p90\": " << Percentile(run.intervals, 90)
+              << ", \"p99\": " << Percentile(run.intervals, 99) << "}";
+
+    if (engine->speculative()) {
+      // Each pass emits the accepted drafts and one token sampled by the
+      // model.
+      Run speculative = Generate(engine.get(), options, tokens, true);
+      const Engine::SpeculationStats& stats = engine->speculation_stats();
+      double decode_tok_s = DecodeTokensPerSecond(speculative);
+      double baseline_tok_s = DecodeTokensPerSecond(run);
+      std::cout << ", \"speculative\": {\"generated_tokens\": "
+                << speculative.generated
+                << ", \"decode_tok_s\": " << decode_tok_s
+                << ", \"acceptance_rate\": "
+                << (stats.drafted ? 1. * stats.accepted / stats.drafted : 0)
+                << ", \"tokens_per_pass\": "
+                << (stats.passes ?
+                    1. * (stats.accepted + stats.passes) / stats.passes : 0)
+                << ", \"speedup\": "
+                << (baseline_tok_s > 0 ? decode_tok_s / baseline_tok_s : 0)
+                << "}";
+    }
+    std::cout << "}";
+  }
+
+  std::cout << "\n  ],\n"
+            << "  \"peak_rss_mb\": " << PeakRSS() << "\n"
+            << "}" << std::endl;
+  return 0;
+}
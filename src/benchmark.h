@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct BenchmarkOptions {
+  // Name of the compiled model, empty for the first one.
+  std::string model;
+  // Draft model for speculative decoding, each prompt is also run with it
+  // when not empty.
+  std::string draft_model;
+  size_t max_draft;
+  // Stream the weights of decoders from the checkpoint.
+  bool layer_streaming;
+  // Number of pipeline stages to run the decoders in, and the CPUs to pin
+  // them to.
+  size_t pipeline_stages;
+  std::vector<int> pipeline_cpus;
+  const char* tokenizer_path;
+  // Prompts to run, each one is a separate run.
+  std::vector<std::string> prompts;
+  // Number of tokens to generate for each prompt.
+  size_t steps;
+  float top_p;
+  unsigned int seed;
+};
+
+// Run the end-to-end benchmark and print the results as JSON to stdout.
+int RunBenchmark(const BenchmarkOptions& options);
@@ -0,0 +1,28 @@
+#include "src/communicator.h"
+
+#include "src/shm_communicator.h"
+
+namespace {
+
+constexpr std::string_view kSharedMemoryPrefix = "shm:";
+
+}  // namespace
+
+// static
+std::unique_ptr<Communicator> Communicator::Create(std::string_view address,
+                                                   size_t rank,
+                                                   size_t ranks,
+                                                   std::string* error) {
+  if (ranks == 0 || rank >= ranks) {
+    *error = "Invalid rank.";
+    return nullptr;
+  }
+  if (address.starts_with(kSharedMemoryPrefix)) {
+    std::string name(address.substr(kSharedMemoryPrefix.size()));
+    return ShmCommunicator::Connect(name.c_str(), rank, ranks, error);
+  }
+  *error = "Unknown transport: " + std::string(address);
+  return nullptr;
+}
+
+Communicator::~Communicator() = default;
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Exchanges data between the ranks of tensor parallel inference, in which
+// each rank is a process running a shard of the model, see
+// RuntimeTransformer. The transports implement this interface, and only a
+// shared memory transport for the processes on one host exists now.
+//
+// All the ranks must make the same calls in the same order.
+class Communicator {
+ public:
+  // Connect to the other ranks at |address| as |rank| of |ranks|, waiting
+  // until all of them are connected. The |address| is "shm:<name>" for the
+  // shared memory transport. Return nullptr and write the reason to |error|
+  // on failure.
+  static std::unique_ptr<Communicator> Create(std::string_view address,
+                                              size_t rank,
+                                              size_t ranks,
+                                              std::string* error);
+
+  virtual ~Communicator();
+
+  // Replace |data| with the sum of the |data| of all ranks, which is
+  // computed in the same order on every rank so they get identical results.
+  virtual void AllReduce(std::span<float> data) = 0;
+
+  size_t rank() const { return rank_; }
+  size_t ranks() const { return ranks_; }
+
+ protected:
+  Communicator(size_t rank, size_t ranks) : rank_(rank), ranks_(ranks) {}
+
+ private:
+  const size_t rank_;
+  const size_t ranks_;
+};
@@ -1,40 +1,38 @@
 #include "src/decoder.h"
 
-namespace {
-
-constexpr
-std::array<float, kLayersSize * kEmbeddingSize> kNormAttWeights = {
-#include "rms_att_weight.inc"
-};
-
-constexpr
-std::array<float, kLayersSize * kEmbeddingSize> kNormFFNWeights = {
-#include "rms_ffn_weight.inc"
-};
-
-}  // namespace
-
-Decoder::Decoder(int layer)
-    : attention_(layer),
-      feed_forward_(layer),
-      attention_norm_(kNormAttWeights, layer * kEmbeddingSize),
-      feed_forward_norm_(kNormFFNWeights, layer * kEmbeddingSize) {}
-
-TensorF<kEmbeddingSize> Decoder::Forward(TensorViewF<kEmbeddingSize> x,
-                                         size_t position) {
-  TensorF<kEmbeddingSize> h = attention_.Forward(
-      RMSNormalize(x, attention_norm_), position);
-
-  // Residual block.
-  for (size_t j = 0; j < kEmbeddingSize; ++j)
-    h[j] += x[j];
-
-  TensorF<kEmbeddingSize> result = feed_forward_.Forward(
-      RMSNormalize(h.View(), feed_forward_norm_));
-
-  // Residual block.
-  for (size_t j = 0; j < kEmbeddingSize; ++j)
-    result[j] += h[j];
-
-  return result;
+#include "models.h"  // generated header
+
+template<typename C>
+Decoder<C>::Decoder(const ModelWeights<C>& weights, int layer)
+    : layer_(layer),
+      attention_(weights, layer),
+      feed_forward_(weights, layer),
+      attention_norm_(weights.attention_norm[layer]),
+      feed_forward_norm_(weights.feed_forward_norm[layer]) {}
+
+template<typename C>
+void Decoder<C>::Forward(
+    MutableTensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+    const Batch& batch,
+    KVCache* kv_cache,
+    Workspace<C>* workspace) const {
+  PROFILE_LAYER(layer_);
+  size_t count = batch.count;
+
+  // Residual block, the attention adds its result to x.
+  for (size_t b = 0; b < count; ++b) {
+    MutableTensorViewF<C::kEmbeddingSize> normalized = workspace->normalized[b];
+    RMSNormalize(x[b], attention_norm_, &normalized);
+  }
+  attention_.Forward(workspace->normalized, batch, kv_cache, workspace, x);
+
+  // Residual block, the feed forward adds its result to x.
+  for (size_t b = 0; b < count; ++b) {
+    MutableTensorViewF<C::kEmbeddingSize> normalized = workspace->normalized[b];
+    RMSNormalize(x[b], feed_forward_norm_, &normalized);
+  }
+  feed_forward_.Forward(workspace->normalized, count, workspace, x);
 }
+
+#define INSTANTIATE_DECODER(C) template class Decoder<C>;
+FROST_FOR_EACH_MODEL(INSTANTIATE_DECODER)
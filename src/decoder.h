@@ -1,19 +1,28 @@
+#pragma once
+
 #include "src/feed_forward.h"
 #include "src/self_attention.h"
 
+template<typename C>
 class Decoder {
  public:
-  explicit Decoder(int layer);
+  Decoder(const ModelWeights<C>& weights, int layer);
 
-  TensorF<kEmbeddingSize> Forward(TensorViewF<kEmbeddingSize> x,
-                                  size_t position);
+  // Transform the rows of residual stream |x| for the tokens of |batch| in
+  // place.
+  void Forward(MutableTensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+               const Batch& batch,
+               KVCache* kv_cache,
+               Workspace<C>* workspace) const;
 
  private:
+  const int layer_;
+
   // The model layers.
-  SelfAttention attention_;
-  const FeedForward feed_forward_;
+  const SelfAttention<C> attention_;
+  const FeedForward<C> feed_forward_;
 
   // The model weights.
-  const TensorViewF<kEmbeddingSize> attention_norm_;
-  const TensorViewF<kEmbeddingSize> feed_forward_norm_;
+  const TensorViewF<C::kEmbeddingSize> attention_norm_;
+  const TensorViewF<C::kEmbeddingSize> feed_forward_norm_;
 };
@@ -0,0 +1,129 @@
+#include "src/detokenizer.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "src/tensor.h"
+
+namespace {
+
+// Encoding of U+FFFD, which replaces the bytes of an incomplete character.
+constexpr std::string_view kReplacementCharacter = "\xef\xbf\xbd";
+
+bool IsContinuation(unsigned char c) {
+  return (c & 0xC0) == 0x80;
+}
+
+// Return how many bytes a UTF-8 character has from its first byte, or 0 if
+// |c| can not start a character.
+size_t UTF8Length(unsigned char c) {
+  if (c < 0x80)
+    return 1;
+  if (c >= 0xC2 && c <= 0xDF)
+    return 2;
+  if (c >= 0xE0 && c <= 0xEF)
+    return 3;
+  if (c >= 0xF0 && c <= 0xF4)
+    return 4;
+  return 0;
+}
+
+// Return whether |second| can follow |first| in a character, which rules out
+// overlong encodings, surrogates and code points above U+10FFFF.
+bool IsValidSecondByte(unsigned char first, unsigned char second) {
+  switch (first) {
+    case 0xE0: return second >= 0xA0 && second <= 0xBF;
+    case 0xED: return second >= 0x80 && second <= 0x9F;
+    case 0xF0: return second >= 0x90 && second <= 0xBF;
+    case 0xF4: return second >= 0x80 && second <= 0x8F;
+    default: return IsContinuation(second);
+  }
+}
+
+}  // namespace
+
+Detokenizer::Detokenizer(const Tokenizer& tokenizer) {
+  size_t size = tokenizer.size();
+  offsets_.reserve(size + 1);
+  for (size_t id = 0; id < size; ++id) {
+    offsets_.push_back(bytes_.size());
+    if (id == Tokenizer::kBosId || id == Tokenizer::kEosId)
+      continue;
+    if (id == Tokenizer::kUnknownId) {
+      // This is what SentencePiece outputs for unknown tokens.
+      bytes_ += " \xe2\x81\x87 ";
+      continue;
+    }
+    std::string_view piece = tokenizer.Piece(id);
+    // Byte fallback tokens like <0x0A> represent a single byte.
+    if (tokenizer.IsByte(id)) {
+      CHECK(piece.size() == 6 && piece.starts_with("<0x"));
+      bytes_ += static_cast<char>(
+          strtol(std::string(piece.substr(3, 2)).c_str(), nullptr, 16));
+      continue;
+    }
+    bytes_ += piece;
+  }
+  offsets_.push_back(bytes_.size());
+  for (size_t id = 0; id < size; ++id)
+    max_piece_size_ = std::max(max_piece_size_, Piece(id).size());
+}
+
+void Detokenizer::Append(int previous, int token, std::string* output) {
+  CHECK(token >= 0 && static_cast<size_t>(token) < offsets_.size() - 1);
+  std::string_view piece = Piece(token);
+  // SentencePiece adds a space before the text when encoding, which should be
+  // removed from the first token.
+  if (previous == Tokenizer::kBosId && piece.starts_with(' '))
+    piece.remove_prefix(1);
+
+  size_t start = output->size();
+  output->append(pending_, pending_size_);
+  output->append(piece);
+  pending_size_ = 0;
+
+  // Validate the characters from the held back bytes, and copy the valid
+  // ones in place. Byte fallback tokens can produce any byte, the bytes that
+  // do not form a character are dropped like llama2.c does.
+  std::string& text = *output;
+  size_t end = text.size();
+  size_t write = start;
+  for (size_t read = start; read < end;) {
+    unsigned char c = text[read];
+    size_t length = UTF8Length(c);
+    if (length == 1) {
+      text[write++] = c;
+      read++;
+      continue;
+    }
+    if (length == 0) {
+      read++;
+      continue;
+    }
+    size_t valid = 1;
+    while (valid < length && read + valid < end &&
+           (valid == 1 ? IsValidSecondByte(c, text[read + 1])
+                       : IsContinuation(text[read + valid]))) {
+      valid++;
+    }
+    if (valid == length) {
+      std::copy_n(text.begin() + read, length, text.begin() + write);
+      write += length;
+      read += length;
+    } else if (read + valid == end) {
+      // The character may complete in following tokens.
+      std::copy(text.begin() + read, text.end(), pending_);
+      pending_size_ = end - read;
+      break;
+    } else {
+      read++;
+    }
+  }
+  text.resize(write);
+}
+
+void Detokenizer::Flush(std::string* output) {
+  if (pending_size_ > 0)
+    output->append(kReplacementCharacter);
+  pending_size_ = 0;
+}
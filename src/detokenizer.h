@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/tokenizer.h"
+
+// Convert tokens to text one by one while streaming.
+//
+// The text of every piece is computed once when loading, so decoding a token
+// is just copying bytes.
+class Detokenizer {
+ public:
+  explicit Detokenizer(const Tokenizer& tokenizer);
+
+  // Append the text of |token| that follows |previous| to |output|, which is
+  // always valid UTF-8. Bytes of an incomplete UTF-8 character are held back
+  // until the character completes in following tokens, and invalid bytes are
+  // dropped.
+  void Append(int previous, int token, std::string* output);
+
+  // Append U+FFFD to |output| for the held back bytes at the end of text, and
+  // drop them.
+  void Flush(std::string* output);
+
+  // Drop the held back bytes, when starting a new text.
+  void Reset() { pending_size_ = 0; }
+
+  // Return the text of |token| without any processing.
+  std::string_view Piece(int token) const {
+    return std::string_view(bytes_.data() + offsets_[token],
+                            offsets_[token + 1] - offsets_[token]);
+  }
+
+  // The longest text a single token can produce.
+  size_t max_piece_size() const { return max_piece_size_; }
+
+ private:
+  // Texts of all pieces stored continuously, the text of token N is
+  // bytes_[offsets_[N]:offsets_[N + 1]].
+  std::string bytes_;
+  std::vector<size_t> offsets_;
+  size_t max_piece_size_ = 0;
+
+  // Bytes of an incomplete UTF-8 character.
+  char pending_[4];
+  size_t pending_size_ = 0;
+};
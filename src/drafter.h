@@ -0,0 +1,33 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "src/language_model.h"
+#include "src/sampler.h"
+
+// Proposes tokens that likely follow a sequence, which the target model then
+// verifies in one forward pass in speculative decoding.
+class Drafter {
+ public:
+  virtual ~Drafter() = default;
+
+  // Propose at most |max_tokens| tokens following |sequence|, and write them
+  // to |tokens|. The distribution each token was sampled from is written to
+  // |probabilities| as one row of vocabulary size for each token, which is
+  // left empty when the tokens are picked deterministically.
+  virtual void Propose(std::span<const int> sequence,
+                       size_t max_tokens,
+                       float top_p,
+                       Sampler* sampler,
+                       std::vector<int>* tokens,
+                       std::vector<float>* probabilities) = 0;
+
+  // Feed |tokens|, which are the last token of the sequence and the drafts,
+  // into |model| at |position| and return the logits for verifying drafts.
+  virtual std::span<float> Verify(LanguageModel* model,
+                                  std::span<const int> tokens,
+                                  size_t position) {
+    return model->Forward(tokens, position);
+  }
+};
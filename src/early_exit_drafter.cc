@@ -0,0 +1,44 @@
+#include "src/early_exit_drafter.h"
+
+#include "src/model_common.h"
+#include "src/trace.h"
+
+EarlyExitDrafter::EarlyExitDrafter(LanguageModel* model, size_t layers)
+    : model_(model), layers_(layers) {
+  CHECK(layers > 0 &&
+        layers < static_cast<size_t>(model->shape().layers_size));
+}
+
+EarlyExitDrafter::~EarlyExitDrafter() = default;
+
+void EarlyExitDrafter::Propose(std::span<const int> sequence,
+                               size_t max_tokens,
+                               float top_p,
+                               Sampler* sampler,
+                               std::vector<int>* tokens,
+                               std::vector<float>* probabilities) {
+  TRACE_EVENT("EarlyExitDrafter::Propose");
+  tokens->clear();
+  probabilities->clear();
+  CHECK(!sequence.empty());
+  // The last token of sequence has not been fed into the model, feed it and
+  // each draft into the first decoders, so the verification can skip them.
+  size_t position = sequence.size() - 1;
+  model_->FeedEarlyExit(sequence.back(), position, layers_);
+  while (tokens->size() < max_tokens) {
+    std::span<float> logits = model_->EarlyExitLogits();
+    Softmax(logits.begin(), logits.end());
+    sampler->TruncateTopP(logits, top_p);
+    probabilities->insert(probabilities->end(), logits.begin(), logits.end());
+    int token = sampler->Sample(logits);
+    tokens->push_back(token);
+    model_->FeedEarlyExit(token, ++position, layers_);
+  }
+}
+
+std::span<float> EarlyExitDrafter::Verify(LanguageModel* model,
+                                          std::span<const int> tokens,
+                                          size_t position) {
+  CHECK_EQ(model, model_);
+  return model->FinishEarlyExit();
+}
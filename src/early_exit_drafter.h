@@ -0,0 +1,29 @@
+#pragma once
+
+#include "src/drafter.h"
+
+// Proposes tokens with the first decoders of the target model itself, which
+// needs no second model. The verification continues from the outputs of the
+// first decoders, so only the rest decoders run again for the drafts.
+class EarlyExitDrafter : public Drafter {
+ public:
+  // The |model| is the target model, whose first |layers| decoders are used
+  // for drafting.
+  EarlyExitDrafter(LanguageModel* model, size_t layers);
+  ~EarlyExitDrafter() override;
+
+  // Drafter:
+  void Propose(std::span<const int> sequence,
+               size_t max_tokens,
+               float top_p,
+               Sampler* sampler,
+               std::vector<int>* tokens,
+               std::vector<float>* probabilities) override;
+  std::span<float> Verify(LanguageModel* model,
+                          std::span<const int> tokens,
+                          size_t position) override;
+
+ private:
+  LanguageModel* model_;
+  const size_t layers_;
+};
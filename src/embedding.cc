@@ -1,26 +1,57 @@
 #include "src/embedding.h"
 
-namespace {
+#include "models.h"  // generated header
 
-// The raw model weights.
-constexpr
-std::array<float, kTokensSize * kEmbeddingSize> kTokenEmbeddingTable = {
-#include "token_embedding_table.inc"
-};
-
-}  // namespace
+template<typename C>
+void Encode(const ModelWeights<C>& weights,
+            int token,
+            MutableTensorViewF<C::kEmbeddingSize> out) {
+  CHECK(token >= 0 && token < static_cast<int>(C::kTokensSize));
+  TensorViewF<C::kEmbeddingSize> embedding =
+      weights.token_embedding_table[token];
+  std::copy(embedding.begin(), embedding.end(), out.begin());
+}
 
-TensorF<kEmbeddingSize> Encode(int token) {
-  CHECK(token >= 0 && token < kTokensSize);
-  TensorF<kEmbeddingSize> result;
-  std::copy(kTokenEmbeddingTable.begin() + token * kEmbeddingSize,
-            kTokenEmbeddingTable.begin() + (token + 1) * kEmbeddingSize,
-            result.begin());
-  return result;
+template<typename C>
+void EmbeddingToTokenLogits(const ModelWeights<C>& weights,
+                            TensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+                            size_t count,
+                            TensorF<kMaxBatchSize, C::kTokensSize>* out) {
+  BatchMatrixProductTo(weights.classifier, x, count, out);
 }
 
-TensorF<kTokensSize> EmbeddingToTokenLogits(TensorViewF<kEmbeddingSize> x) {
-  return MatrixProduct(
-      TensorViewF<kTokensSize, kEmbeddingSize>(kTokenEmbeddingTable),
-      x);
+template<typename C>
+void EmbeddingToTokenLogits(const ModelWeights<C>& weights,
+                            TensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+                            size_t count,
+                            std::span<const int> tokens,
+                            TensorF<kMaxBatchSize, C::kTokensSize>* out) {
+  PROFILE_OP(kMatrixProduct,
+             sizeof(float) * (tokens.size() * C::kEmbeddingSize +
+                              count * (C::kEmbeddingSize + C::kTokensSize)));
+  CHECK_LE(count, kMaxBatchSize);
+  for (size_t b = 0; b < count; ++b)
+    std::fill((*out)[b].begin(), (*out)[b].end(), kMaskedLogit);
+  // Like BatchMatrixProductTo, each row is read once for all vectors.
+  for (int token : tokens) {
+    auto row = weights.classifier[token];
+    for (size_t b = 0; b < count; ++b)
+      (*out)[b][token] = DotProduct(row, x[b]);
+  }
 }
+
+#define INSTANTIATE_EMBEDDING(C)                                              \
+  template void Encode(const ModelWeights<C>&, int,                           \
+                       MutableTensorViewF<C::kEmbeddingSize>);                \
+  template void EmbeddingToTokenLogits(                                       \
+      const ModelWeights<C>&,                                                 \
+      TensorViewF<kMaxBatchSize, C::kEmbeddingSize>,                          \
+      size_t,                                                                 \
+      TensorF<kMaxBatchSize, C::kTokensSize>*);                               \
+  template void EmbeddingToTokenLogits(                                       \
+      const ModelWeights<C>&,                                                 \
+      TensorViewF<kMaxBatchSize, C::kEmbeddingSize>,                          \
+      size_t,                                                                 \
+      std::span<const int>,                                                   \
+      TensorF<kMaxBatchSize, C::kTokensSize>*);
+FROST_FOR_EACH_MODEL(INSTANTIATE_EMBEDDING)
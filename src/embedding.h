@@ -1,9 +1,27 @@
 #pragma once
 
-#include "src/model_common.h"
+#include "src/model_weights.h"
 
 // Convert a token to embedding.
-TensorF<kEmbeddingSize> Encode(int token);
+template<typename C>
+void Encode(const ModelWeights<C>& weights,
+            int token,
+            MutableTensorViewF<C::kEmbeddingSize> out);
 
-// The weights used for encoding embeddings is also used for decoding.
-TensorF<kTokensSize> EmbeddingToTokenLogits(TensorViewF<kEmbeddingSize> x);
+// Convert embeddings to logits with the classifier, which usually shares the
+// weights used for encoding embeddings. The logits of the first |count| rows
+// of |x| are written to |out|.
+template<typename C>
+void EmbeddingToTokenLogits(const ModelWeights<C>& weights,
+                            TensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+                            size_t count,
+                            TensorF<kMaxBatchSize, C::kTokensSize>* out);
+
+// Same with above but only compute the logits of the sorted |tokens|, and set
+// the others to kMaskedLogit.
+template<typename C>
+void EmbeddingToTokenLogits(const ModelWeights<C>& weights,
+                            TensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+                            size_t count,
+                            std::span<const int> tokens,
+                            TensorF<kMaxBatchSize, C::kTokensSize>* out);
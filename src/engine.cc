@@ -0,0 +1,708 @@
+#include "src/engine.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+
+#include "src/early_exit_drafter.h"
+#include "src/model_drafter.h"
+#include "src/ngram_drafter.h"
+#include "src/trace.h"
+
+namespace {
+
+// Write the |k| largest probabilities and their tokens to |top|.
+void TopK(std::span<const float> probabilities,
+          size_t k,
+          std::vector<std::pair<float, int>>* top) {
+  // Keep a min-heap of the k largest ones.
+  top->clear();
+  for (size_t i = 0; i < probabilities.size(); ++i) {
+    std::pair<float, int> element(probabilities[i], i);
+    if (top->size() < k) {
+      top->push_back(element);
+      std::push_heap(top->begin(), top->end(), std::greater<>());
+    } else if (element > top->front()) {
+      std::pop_heap(top->begin(), top->end(), std::greater<>());
+      top->back() = element;
+      std::push_heap(top->begin(), top->end(), std::greater<>());
+    }
+  }
+}
+
+// Return the log of softmax(logits)[token].
+float LogProbability(std::span<const float> logits, int token) {
+  float max = *std::max_element(logits.begin(), logits.end());
+  float sum = 0;
+  for (float logit : logits)
+    sum += std::exp(logit - max);
+  return logits[token] - max - std::log(sum);
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<Engine> Engine::Create(std::string_view model,
+                                       const char* tokenizer_path,
+                                       std::string* error) {
+  return Create(LanguageModel::CreateOrLoad(model, error), tokenizer_path,
+                error);
+}
+
+// static
+std::unique_ptr<Engine> Engine::CreateShard(
+    std::string_view model,
+    const char* tokenizer_path,
+    std::unique_ptr<Communicator> communicator,
+    std::string* error) {
+  return Create(LanguageModel::Load(std::string(model).c_str(), error,
+                                    std::move(communicator)),
+                tokenizer_path, error);
+}
+
+// static
+std::unique_ptr<Engine> Engine::Create(std::unique_ptr<LanguageModel> model,
+                                       const char* tokenizer_path,
+                                       std::string* error) {
+  if (!model)
+    return nullptr;
+  std::unique_ptr<Engine> engine(new Engine);
+  engine->model_ = std::move(model);
+  engine->tokenizer_ = Tokenizer::Load(tokenizer_path,
+                                       engine->model_->shape().tokens_size,
+                                       error);
+  if (!engine->tokenizer_)
+    return nullptr;
+
+  engine->detokenizer_ = std::make_unique<Detokenizer>(*engine->tokenizer_);
+  // Reserve space for the decoded text so decoding never allocates.
+  engine->piece_.reserve(engine->detokenizer_->max_piece_size() + 4);
+  engine->tokens_.reserve(engine->model_->shape().sequence_size);
+  return engine;
+}
+
+Engine::~Engine() = default;
+
+std::vector<int> Engine::Tokenize(std::string_view text, bool add_bos) const {
+  std::vector<int> tokens;
+  tokenizer_->Encode(text, add_bos, &tokens);
+  return tokens;
+}
+
+void Engine::Prefill(std::span<const int> tokens) {
+  for (size_t i = 0; i < tokens.size(); i += kMaxBatchSize)
+    Feed(tokens.subspan(i, std::min(kMaxBatchSize, tokens.size() - i)));
+}
+
+void Engine::Step(int token) {
+  Feed(std::span<const int>(&token, 1));
+}
+
+bool Engine::PrefillPrompt(std::string_view prompt) {
+  Reset();
+  // The first token is always BOS.
+  std::vector<int> tokens = Tokenize(prompt, true);
+  if (tokens.size() > static_cast<size_t>(model_->shape().sequence_size))
+    return false;
+  Prefill(tokens);
+  return true;
+}
+
+void Engine::Feed(std::span<const int> tokens) {
+  CHECK_LE(position_ + tokens.size(),
+           static_cast<size_t>(model_->shape().sequence_size));
+  std::span<float> logits = model_->Forward(tokens, position_);
+  // Only the logits of the last token are needed.
+  logits_ = logits.last(model_->shape().tokens_size);
+  tokens_.insert(tokens_.end(), tokens.begin(), tokens.end());
+  last_token_ = tokens.back();
+  position_ += tokens.size();
+}
+
+int Engine::Sample(float top_p) {
+  CHECK(!logits_.empty());
+  Softmax(logits_.begin(), logits_.end());
+  PROFILE_OP(kSampling, sizeof(float) * logits_.size());
+  return sampler_.SampleTopP(logits_, top_p);
+}
+
+bool Engine::UseDraftModel(std::string_view model,
+                           size_t max_draft,
+                           std::string* error) {
+  if (model == "ngram") {
+    UseDrafter(std::make_unique<NgramDrafter>(), max_draft);
+    return true;
+  }
+  constexpr std::string_view kEarlyExit = "early-exit:";
+  if (model.starts_with(kEarlyExit)) {
+    int layers = atoi(std::string(model.substr(kEarlyExit.size())).c_str());
+    if (layers <= 0 || layers >= model_->shape().layers_size) {
+      *error = "The early exit layers must be less than the model's " +
+               std::to_string(model_->shape().layers_size) + " layers.";
+      return false;
+    }
+    UseDrafter(std::make_unique<EarlyExitDrafter>(model_.get(), layers),
+               max_draft);
+    return true;
+  }
+  std::unique_ptr<LanguageModel> draft =
+      LanguageModel::CreateOrLoad(model, error);
+  if (!draft)
+    return false;
+  if (draft->shape().tokens_size != model_->shape().tokens_size) {
+    *error = "The draft model has a different vocabulary.";
+    return false;
+  }
+  UseDrafter(std::make_unique<ModelDrafter>(std::move(draft)), max_draft);
+  return true;
+}
+
+void Engine::UseDrafter(std::unique_ptr<Drafter> drafter, size_t max_draft) {
+  drafter_ = std::move(drafter);
+  // The token and the drafts are fed in one pass.
+  max_draft_ = std::min(max_draft, kMaxBatchSize - 1);
+}
+
+void Engine::Speculate(int token, float top_p, std::vector<int>* output) {
+  TRACE_EVENT("Engine::Speculate");
+  CHECK(drafter_);
+  size_t sequence_size = model_->shape().sequence_size;
+  CHECK_LT(position_, sequence_size);
+  size_t max_draft = std::min(max_draft_, sequence_size - position_ - 1);
+
+  // Propose the drafts following the token.
+  tokens_.push_back(token);
+  drafter_->Propose(tokens_, max_draft, top_p, &sampler_, &drafts_,
+                    &draft_probabilities_);
+  tokens_.pop_back();
+  CHECK_LE(drafts_.size(), max_draft);
+
+  // Verify the drafts in one pass, the logits of the i-th row decide whether
+  // the i-th draft is accepted.
+  batch_.assign(1, token);
+  batch_.insert(batch_.end(), drafts_.begin(), drafts_.end());
+  std::span<float> logits = drafter_->Verify(model_.get(), batch_, position_);
+  size_t vocab = model_->shape().tokens_size;
+
+  output->clear();
+  size_t accepted = 0;
+  for (; accepted < drafts_.size(); ++accepted) {
+    std::span<float> p = logits.subspan(accepted * vocab, vocab);
+    Softmax(p.begin(), p.end());
+    sampler_.TruncateTopP(p, top_p);
+    int draft = drafts_[accepted];
+    // The drafts picked deterministically have a probability of 1.
+    std::span<const float> q;
+    if (!draft_probabilities_.empty()) {
+      q = std::span<const float>(draft_probabilities_)
+              .subspan(accepted * vocab, vocab);
+    }
+    float q_draft = q.empty() ? 1.f : q[draft];
+    // Accept the draft with probability min(1, p / q).
+    if (sampler_.Uniform() * q_draft < p[draft]) {
+      output->push_back(draft);
+      continue;
+    }
+    // Otherwise sample from the distribution of max(0, p - q), which makes
+    // the result have exactly the distribution of p.
+    if (q.empty()) {
+      p[draft] = 0;
+    } else {
+      for (size_t i = 0; i < vocab; ++i)
+        p[i] = std::max(p[i] - q[i], 0.f);
+    }
+    output->push_back(sampler_.Sample(p));
+    break;
+  }
+  if (accepted == drafts_.size()) {
+    // All drafts are accepted, and the last row gives one more token.
+    std::span<float> p = logits.subspan(accepted * vocab, vocab);
+    Softmax(p.begin(), p.end());
+    output->push_back(sampler_.SampleTopP(p, top_p));
+  }
+
+  // Keep the token and the accepted drafts. The KV cache of the rejected
+  // drafts is rolled back by moving the position, and overwritten later.
+  tokens_.push_back(token);
+  tokens_.insert(tokens_.end(), drafts_.begin(), drafts_.begin() + accepted);
+  position_ = tokens_.size();
+  last_token_ = tokens_.back();
+  // The logits of the kept tokens have been consumed.
+  logits_ = {};
+
+  stats_.passes++;
+  stats_.drafted += drafts_.size();
+  stats_.accepted += accepted;
+}
+
+std::string_view Engine::Decode(int previous, int token) {
+  PROFILE_OP(kDetokenization, detokenizer_->Piece(token).size());
+  piece_.clear();
+  detokenizer_->Append(previous, token, &piece_);
+  return piece_;
+}
+
+std::string_view Engine::FlushDecode() {
+  piece_.clear();
+  detokenizer_->Flush(&piece_);
+  return piece_;
+}
+
+size_t Engine::Generate(std::string_view prompt,
+                        size_t max_tokens,
+                        float top_p,
+                        const TokenCallback& callback) {
+  if (!PrefillPrompt(prompt))
+    return 0;
+
+  // The tokens sampled from the model, only the last one has not been fed into
+  // the model.
+  std::vector<int>& pending = pending_;
+  // Sample the result to predict the next token.
+  pending.assign(1, Sample(top_p));
+  size_t next = 0;
+  int previous = last_token_;
+
+  size_t generated = 0;
+  while (generated < max_tokens) {
+    int token = pending[next++];
+
+    // End of sequence.
+    if (token == eos_id() || token == bos_id())
+      break;
+
+    generated++;
+    if (!callback(token, Decode(previous, token)))
+      return generated;
+    previous = token;
+    if (next < pending.size())
+      continue;
+
+    // The model can not see more tokens.
+    if (position_ == static_cast<size_t>(model_->shape().sequence_size))
+      break;
+    if (drafter_) {
+      Speculate(token, top_p, &pending);
+    } else {
+      Step(token);
+      pending.assign(1, Sample(top_p));
+    }
+    next = 0;
+  }
+  std::string_view rest = FlushDecode();
+  if (!rest.empty())
+    callback(eos_id(), rest);
+  return generated;
+}
+
+std::vector<Engine::Completion> Engine::GenerateSamples(
+    std::string_view prompt,
+    size_t n,
+    size_t max_tokens,
+    float top_p) {
+  TRACE_EVENT("Engine::GenerateSamples");
+  if (!PrefillPrompt(prompt))
+    return {};
+  n = std::min(n, kMaxBatchSize);
+  size_t prompt_size = position_;
+  size_t sequence_size = model_->shape().sequence_size;
+  size_t vocab = model_->shape().tokens_size;
+
+  // Each completion runs on its own sequence forked from the prompt, which is
+  // on sequence 0.
+  std::vector<Completion> completions(n);
+  std::vector<bool> finished(n);
+  for (size_t i = 0; i < n; ++i)
+    model_->Fork(0, i + 1, prompt_size);
+
+  // The first tokens are sampled from the logits of the prompt.
+  Softmax(logits_.begin(), logits_.end());
+  std::array<std::span<float>, kMaxBatchSize> rows;
+  std::array<size_t, kMaxBatchSize> indices;
+  for (size_t i = 0; i < n; ++i) {
+    rows[i] = logits_;
+    indices[i] = i;
+  }
+  size_t count = n;
+  while (true) {
+    // Sample the next token of each completion in the batch.
+    for (size_t b = 0; b < count; ++b) {
+      Completion& completion = completions[indices[b]];
+      int token = sampler_.SampleTopP(rows[b], top_p);
+      if (token == eos_id() || token == bos_id()) {
+        finished[indices[b]] = true;
+        continue;
+      }
+      completion.tokens.push_back(token);
+      completion.log_probability += std::log(rows[b][token]);
+    }
+
+    // Feed the new tokens of unfinished completions in one pass.
+    std::array<int, kMaxBatchSize> tokens;
+    std::array<int, kMaxBatchSize> sequences;
+    std::array<size_t, kMaxBatchSize> positions;
+    count = 0;
+    for (size_t i = 0; i < n; ++i) {
+      const Completion& completion = completions[i];
+      size_t position = prompt_size + completion.tokens.size() - 1;
+      if (finished[i] || completion.tokens.size() >= max_tokens ||
+          position >= sequence_size) {
+        continue;
+      }
+      tokens[count] = completion.tokens.back();
+      sequences[count] = i + 1;
+      positions[count] = position;
+      indices[count] = i;
+      count++;
+    }
+    if (count == 0)
+      break;
+    std::span<float> logits = model_->Forward(
+        std::span<const int>(tokens.data(), count),
+        std::span<const int>(sequences.data(), count),
+        std::span<const size_t>(positions.data(), count));
+    for (size_t b = 0; b < count; ++b) {
+      rows[b] = logits.subspan(b * vocab, vocab);
+      Softmax(rows[b].begin(), rows[b].end());
+    }
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    model_->Release(i + 1);
+    DecodeCompletion(&completions[i]);
+  }
+  // The logits of the prompt have been consumed.
+  logits_ = {};
+  return completions;
+}
+
+std::vector<Engine::Completion> Engine::BeamSearch(std::string_view prompt,
+                                                   size_t beam_width,
+                                                   size_t max_tokens) {
+  TRACE_EVENT("Engine::BeamSearch");
+  if (!PrefillPrompt(prompt))
+    return {};
+  beam_width = std::clamp<size_t>(beam_width, 1, kMaxBatchSize);
+  size_t prompt_size = position_;
+  size_t sequence_size = model_->shape().sequence_size;
+  size_t vocab = model_->shape().tokens_size;
+
+  struct Beam {
+    int sequence;
+    Completion completion;
+  };
+  // The search starts from the prompt on sequence 0, which is never written.
+  std::vector<Beam> beams = {{0, Completion()}};
+  std::vector<Completion> finished;
+  // The sequences not used by beams.
+  std::vector<int> free_sequences;
+  for (int i = kMaxSequences - 1; i > 0; --i)
+    free_sequences.push_back(i);
+
+  Softmax(logits_.begin(), logits_.end());
+  std::array<std::span<float>, kMaxBatchSize> rows;
+  rows[0] = logits_;
+  std::vector<std::pair<float, int>> top;
+  while (!beams.empty()) {
+    // Only the best |beam_width| tokens of each beam can be in the best
+    // |beam_width| children of all beams.
+    struct Candidate {
+      float score;
+      size_t beam;
+      int token;
+    };
+    std::vector<Candidate> candidates;
+    for (size_t i = 0; i < beams.size(); ++i) {
+      TopK(rows[i], beam_width, &top);
+      for (const auto& [probability, token] : top) {
+        candidates.push_back({
+            beams[i].completion.log_probability + std::log(probability),
+            i, token});
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const auto& a, const auto& b) { return a.score > b.score; });
+
+    // Fork the beams of the best candidates, and finish the ones ending.
+    std::vector<Beam> children;
+    for (size_t rank = 0; rank < candidates.size(); ++rank) {
+      const Candidate& candidate = candidates[rank];
+      const Beam& parent = beams[candidate.beam];
+      if (candidate.token == eos_id() || candidate.token == bos_id()) {
+        if (rank < beam_width) {
+          finished.push_back(parent.completion);
+          finished.back().log_probability = candidate.score;
+        }
+        continue;
+      }
+      Beam child{free_sequences.back(), parent.completion};
+      free_sequences.pop_back();
+      model_->Fork(parent.sequence, child.sequence,
+                   prompt_size + parent.completion.tokens.size());
+      child.completion.tokens.push_back(candidate.token);
+      child.completion.log_probability = candidate.score;
+      children.push_back(std::move(child));
+      if (children.size() == beam_width)
+        break;
+    }
+    for (const Beam& beam : beams) {
+      if (beam.sequence != 0) {
+        model_->Release(beam.sequence);
+        free_sequences.push_back(beam.sequence);
+      }
+    }
+    beams = std::move(children);
+
+    // The search ends when there are enough finished completions, or the
+    // best finished one is better than all beams, as the scores of beams
+    // only decrease.
+    bool done = finished.size() >= beam_width;
+    if (!finished.empty() && !beams.empty()) {
+      float best_finished = std::max_element(
+          finished.begin(), finished.end(),
+          [](const auto& a, const auto& b) {
+            return a.log_probability < b.log_probability;
+          })->log_probability;
+      done |= best_finished >= beams[0].completion.log_probability;
+    }
+    // Or when the beams are too long.
+    if (!beams.empty()) {
+      size_t size = beams[0].completion.tokens.size();
+      done |= size >= max_tokens || prompt_size + size > sequence_size - 1;
+    }
+    if (done)
+      break;
+
+    // Feed the last tokens of all beams in one pass.
+    std::array<int, kMaxBatchSize> tokens;
+    std::array<int, kMaxBatchSize> sequences;
+    std::array<size_t, kMaxBatchSize> positions;
+    for (size_t i = 0; i < beams.size(); ++i) {
+      tokens[i] = beams[i].completion.tokens.back();
+      sequences[i] = beams[i].sequence;
+      positions[i] = prompt_size + beams[i].completion.tokens.size() - 1;
+    }
+    std::span<float> logits = model_->Forward(
+        std::span<const int>(tokens.data(), beams.size()),
+        std::span<const int>(sequences.data(), beams.size()),
+        std::span<const size_t>(positions.data(), beams.size()));
+    for (size_t i = 0; i < beams.size(); ++i) {
+      rows[i] = logits.subspan(i * vocab, vocab);
+      Softmax(rows[i].begin(), rows[i].end());
+    }
+  }
+
+  // The unfinished beams are also results.
+  for (Beam& beam : beams) {
+    model_->Release(beam.sequence);
+    finished.push_back(std::move(beam.completion));
+  }
+  std::sort(finished.begin(), finished.end(),
+            [](const auto& a, const auto& b) {
+              return a.log_probability > b.log_probability;
+            });
+  if (finished.size() > beam_width)
+    finished.resize(beam_width);
+  for (Completion& completion : finished)
+    DecodeCompletion(&completion);
+  // The logits of the prompt have been consumed.
+  logits_ = {};
+  return finished;
+}
+
+std::vector<float> Engine::ScoreText(std::string_view text) {
+  TRACE_EVENT("Engine::ScoreText");
+  Reset();
+  std::vector<int> tokens = Tokenize(text, true);
+  std::vector<float> log_probabilities(tokens.size() - 1);
+  // Each chunk feeds sequence_size - 1 tokens and the last token of a chunk
+  // is the first one of next chunk, so all tokens except BOS are scored once.
+  // The chunks alternate between sequences 1 and 2, so the end of a chunk and
+  // the beginning of next chunk can be fed in one pass.
+  size_t chunk_size = model_->shape().sequence_size - 1;
+  std::vector<ScoreRow> rows;
+  rows.reserve(log_probabilities.size());
+  for (size_t i = 0; i < log_probabilities.size(); ++i) {
+    rows.push_back({tokens[i], static_cast<int>(1 + i / chunk_size % 2),
+                    i % chunk_size, tokens[i + 1], &log_probabilities[i]});
+  }
+  ScoreRows(rows);
+  model_->Release(1);
+  model_->Release(2);
+  return log_probabilities;
+}
+
+std::vector<std::vector<float>> Engine::ScoreContinuations(
+    std::string_view context,
+    std::span<const std::string> continuations) {
+  TRACE_EVENT("Engine::ScoreContinuations");
+  Reset();
+  size_t sequence_size = model_->shape().sequence_size;
+  std::vector<int> context_tokens = Tokenize(context, true);
+  if (context_tokens.size() > sequence_size)
+    context_tokens.resize(sequence_size);
+  Prefill(context_tokens);
+  logits_ = {};
+
+  // The continuations are tokenized with the context, as the tokens at the
+  // boundary may merge, and the tokens after the ones shared with the context
+  // are scored.
+  std::vector<std::vector<int>> tokens;
+  std::vector<size_t> shared;
+  std::vector<std::vector<float>> log_probabilities;
+  for (const std::string& continuation : continuations) {
+    std::string text(context);
+    text += continuation;
+    tokens.push_back(Tokenize(text, true));
+    if (tokens.back().size() > sequence_size)
+      tokens.back().resize(sequence_size);
+    auto [end, _] = std::mismatch(context_tokens.begin(), context_tokens.end(),
+                                  tokens.back().begin(), tokens.back().end());
+    // The BOS token is always shared.
+    shared.push_back(std::max<size_t>(end - context_tokens.begin(), 1));
+    log_probabilities.emplace_back(tokens.back().size() - shared.back());
+  }
+
+  // Each continuation forks the context and feeds its tokens on its own
+  // sequence, at most kMaxSequences - 1 of them at a time. The last shared
+  // token is fed again to predict the first token of continuation.
+  std::vector<ScoreRow> rows;
+  for (size_t begin = 0; begin < continuations.size();
+       begin += kMaxSequences - 1) {
+    size_t end = std::min(begin + kMaxSequences - 1, continuations.size());
+    rows.clear();
+    for (size_t i = begin; i < end; ++i) {
+      int sequence = 1 + i - begin;
+      model_->Fork(0, sequence, shared[i] - 1);
+      for (size_t j = 0; j < log_probabilities[i].size(); ++j) {
+        size_t position = shared[i] - 1 + j;
+        rows.push_back({tokens[i][position], sequence, position,
+                        tokens[i][position + 1], &log_probabilities[i][j]});
+      }
+    }
+    ScoreRows(rows);
+    for (size_t i = begin; i < end; ++i)
+      model_->Release(1 + i - begin);
+  }
+  return log_probabilities;
+}
+
+void Engine::ScoreRows(std::span<const ScoreRow> rows) {
+  size_t vocab = model_->shape().tokens_size;
+  for (size_t i = 0; i < rows.size(); i += kMaxBatchSize) {
+    size_t count = std::min(kMaxBatchSize, rows.size() - i);
+    std::array<int, kMaxBatchSize> tokens;
+    std::array<int, kMaxBatchSize> sequences;
+    std::array<size_t, kMaxBatchSize> positions;
+    for (size_t b = 0; b < count; ++b) {
+      tokens[b] = rows[i + b].token;
+      sequences[b] = rows[i + b].sequence;
+      positions[b] = rows[i + b].position;
+    }
+    std::span<float> logits = model_->Forward(
+        std::span<const int>(tokens.data(), count),
+        std::span<const int>(sequences.data(), count),
+        std::span<const size_t>(positions.data(), count));
+    for (size_t b = 0; b < count; ++b) {
+      *rows[i + b].log_probability = LogProbability(
+          logits.subspan(b * vocab, vocab), rows[i + b].target);
+    }
+  }
+}
+
+std::vector<std::vector<float>> Engine::Embed(
+    std::span<const std::string> texts,
+    Pooling pooling) {
+  TRACE_EVENT("Engine::Embed");
+  Reset();
+  size_t sequence_size = model_->shape().sequence_size;
+  size_t dim = model_->shape().embedding_size;
+  std::vector<std::vector<float>> embeddings(texts.size(),
+                                             std::vector<float>(dim));
+  std::vector<size_t> sizes(texts.size());
+
+  // The i-th token of a pass is from the |indices[i]|-th text.
+  std::array<int, kMaxBatchSize> tokens;
+  std::array<int, kMaxBatchSize> sequences;
+  std::array<size_t, kMaxBatchSize> positions;
+  std::array<size_t, kMaxBatchSize> indices;
+  size_t count = 0;
+  auto run_pass = [&]() {
+    std::span<float> hidden = model_->ForwardHidden(
+        std::span<const int>(tokens.data(), count),
+        std::span<const int>(sequences.data(), count),
+        std::span<const size_t>(positions.data(), count));
+    for (size_t b = 0; b < count; ++b) {
+      std::span<const float> row = hidden.subspan(b * dim, dim);
+      std::vector<float>& embedding = embeddings[indices[b]];
+      if (pooling == Pooling::kLast) {
+        std::copy(row.begin(), row.end(), embedding.begin());
+      } else {
+        for (size_t i = 0; i < dim; ++i)
+          embedding[i] += row[i];
+      }
+    }
+    count = 0;
+  };
+  for (size_t i = 0; i < texts.size(); ++i) {
+    std::vector<int> text_tokens = Tokenize(texts[i], true);
+    sizes[i] = std::min(text_tokens.size(), sequence_size);
+    for (size_t j = 0; j < sizes[i]; ++j) {
+      // A pass has at most kMaxBatchSize texts, so the texts in one pass never
+      // share a sequence.
+      tokens[count] = text_tokens[j];
+      sequences[count] = 1 + i % (kMaxSequences - 1);
+      positions[count] = j;
+      indices[count] = i;
+      if (++count == kMaxBatchSize)
+        run_pass();
+    }
+  }
+  if (count > 0)
+    run_pass();
+
+  if (pooling == Pooling::kMean) {
+    for (size_t i = 0; i < texts.size(); ++i) {
+      for (float& value : embeddings[i])
+        value /= sizes[i];
+    }
+  }
+  for (size_t i = 0; i < std::min(texts.size(), kMaxSequences - 1); ++i)
+    model_->Release(1 + i);
+  return embeddings;
+}
+
+void Engine::DecodeCompletion(Completion* completion) {
+  detokenizer_->Reset();
+  int previous = last_token_;
+  for (int token : completion->tokens) {
+    detokenizer_->Append(previous, token, &completion->text);
+    previous = token;
+  }
+  detokenizer_->Flush(&completion->text);
+}
+
+bool Engine::SetAllowedTokens(std::span<const int> tokens) {
+  std::vector<int> sorted(tokens.begin(), tokens.end());
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+  if (!sorted.empty() &&
+      (sorted.front() < 0 || sorted.back() >= model_->shape().tokens_size)) {
+    return false;
+  }
+  model_->SetAllowedTokens(sorted);
+  return true;
+}
+
+void Engine::Reset() {
+  // The KV cache at a position is always overwritten before being read, so
+  // there is no need to clear it.
+  tokens_.clear();
+  position_ = 0;
+  last_token_ = -1;
+  logits_ = {};
+  stats_ = SpeculationStats();
+  detokenizer_->Reset();
+}
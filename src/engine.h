@@ -0,0 +1,263 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/detokenizer.h"
+#include "src/drafter.h"
+#include "src/language_model.h"
+#include "src/sampler.h"
+#include "src/model_common.h"
+#include "src/tokenizer.h"
+
+// Owns the tokenizer and the model, and keeps the state of one sequence.
+//
+// The typical usage is:
+//   auto engine = Engine::Create("", "assets/tokenizer.bin", &error);
+//   engine->Prefill(engine->Tokenize(prompt, true));
+//   while (...) {
+//     int token = engine->Sample(0.9);
+//     engine->Step(token);
+//   }
+class Engine {
+ public:
+  // Called for each generated token with the decoded text, return false to
+  // stop the generation. When the text ends with an incomplete UTF-8
+  // character, it is called once more with EOS and U+FFFD.
+  using TokenCallback = std::function<bool(int token, std::string_view piece)>;
+
+  // Create an engine running the compiled |model|, or the first compiled model
+  // when |model| is empty, or the llama2.c checkpoint when |model| is a path.
+  // Return nullptr and write the reason to |error| on failure.
+  static std::unique_ptr<Engine> Create(std::string_view model,
+                                        const char* tokenizer_path,
+                                        std::string* error);
+
+  // Create an engine running the shard of llama2.c checkpoint |model| for the
+  // rank of |communicator| in tensor parallel inference. All the ranks must
+  // make the same calls with the same seed, which then generate the same
+  // tokens.
+  static std::unique_ptr<Engine> CreateShard(
+      std::string_view model,
+      const char* tokenizer_path,
+      std::unique_ptr<Communicator> communicator,
+      std::string* error);
+
+  ~Engine();
+
+  // A completion of a prompt.
+  struct Completion {
+    std::vector<int> tokens;
+    std::string text;
+    // Sum of the log probabilities of the tokens.
+    float log_probability = 0;
+  };
+
+  // How the hidden states of the tokens of a text are pooled into one
+  // embedding.
+  enum class Pooling {
+    kMean,
+    kLast,
+  };
+
+  // How well the drafts were accepted in speculative decoding.
+  struct SpeculationStats {
+    // Forward passes of the target model.
+    size_t passes = 0;
+    size_t drafted = 0;
+    size_t accepted = 0;
+  };
+
+  Engine(const Engine&) = delete;
+  Engine& operator=(const Engine&) = delete;
+
+  // Convert text to tokens, optionally prepending the BOS token.
+  std::vector<int> Tokenize(std::string_view text, bool add_bos) const;
+
+  // Feed |tokens| into the model, after which the logits of the next token
+  // are available for sampling. The tokens fed since Reset must fit in the
+  // model's sequence.
+  void Prefill(std::span<const int> tokens);
+
+  // Feed a single token into the model.
+  void Step(int token);
+
+  // Pick the next token from the logits computed by the last Prefill/Step.
+  int Sample(float top_p);
+
+  // Use the compiled model or llama2.c checkpoint |model| to propose at most
+  // |max_draft| tokens for each pass in speculative decoding, or propose by
+  // looking up n-grams in the sequence when |model| is "ngram", or propose
+  // with the first L decoders of the model when |model| is "early-exit:L".
+  // Return false and write the reason to |error| on failure.
+  bool UseDraftModel(std::string_view model,
+                     size_t max_draft,
+                     std::string* error);
+
+  // Use |drafter| to propose at most |max_draft| tokens for each pass.
+  void UseDrafter(std::unique_ptr<Drafter> drafter, size_t max_draft);
+
+  bool speculative() const { return drafter_ != nullptr; }
+
+  // The speculative version of Step and Sample: feed |token| followed by the
+  // tokens proposed by the drafter in one forward pass, and write the drafts
+  // accepted by the model and one more token sampled from the model to
+  // |output|. The last token of |output| has not been fed into the model yet,
+  // like the result of Sample.
+  //
+  // The drafts are accepted with rejection sampling, so the tokens have the
+  // same distribution with calling Step and Sample for each token.
+  void Speculate(int token, float top_p, std::vector<int>* output);
+
+  // Convert the |token| following |previous| to text, the result is valid
+  // until next call.
+  std::string_view Decode(int previous, int token);
+
+  // Return U+FFFD if the text decoded so far ends with an incomplete UTF-8
+  // character, otherwise an empty string. Call at the end of the text.
+  std::string_view FlushDecode();
+
+  // Run the whole generation loop for |prompt|, and stream the generated
+  // tokens to |callback|. Return the number of generated tokens, which is 0
+  // when the prompt is longer than the model's sequence.
+  size_t Generate(std::string_view prompt,
+                  size_t max_tokens,
+                  float top_p,
+                  const TokenCallback& callback);
+
+  // Generate |n| completions of |prompt| by sampling, at most kMaxBatchSize
+  // of them. The prompt is fed once and forked into the sequences of
+  // completions, which share the KV cache of the prompt and decode together
+  // in one batch. Return nothing when the prompt is longer than the model's
+  // sequence.
+  std::vector<Completion> GenerateSamples(std::string_view prompt,
+                                          size_t n,
+                                          size_t max_tokens,
+                                          float top_p);
+
+  // Return the most likely completions of |prompt| found by beam search with
+  // |beam_width| beams, at most kMaxBatchSize of them, sorted by likelihood.
+  // Each step forks the best beams and releases the others, like
+  // GenerateSamples the beams share the KV cache of their common prefix.
+  // Return nothing when the prompt is longer than the model's sequence.
+  std::vector<Completion> BeamSearch(std::string_view prompt,
+                                     size_t beam_width,
+                                     size_t max_tokens);
+
+  // Return the log probability of each token of |text| given the tokens before
+  // it, the BOS token at the beginning is not scored. A text longer than the
+  // model's sequence is split into chunks, and the tokens only see the tokens
+  // before them in the same chunk.
+  std::vector<float> ScoreText(std::string_view text);
+
+  // Return the log probabilities of the tokens of each continuation following
+  // |context|. The context is fed once and its KV cache is shared by all the
+  // continuations. The tokens beyond the model's sequence are not scored.
+  std::vector<std::vector<float>> ScoreContinuations(
+      std::string_view context,
+      std::span<const std::string> continuations);
+
+  // Return the embedding of each of |texts|, which is the hidden states after
+  // the final normalization pooled by |pooling|. Each text is fed on its own
+  // sequence, so the tokens of many short texts are fed in one pass. The
+  // tokens beyond the model's sequence are ignored.
+  std::vector<std::vector<float>> Embed(std::span<const std::string> texts,
+                                        Pooling pooling);
+
+  // Forget the current sequence.
+  void Reset();
+
+  // Only allow sampling |tokens| after next pass of the model, whose logits
+  // are the only ones computed, or allow all tokens when |tokens| is empty.
+  // Return false if a token is not in the vocabulary.
+  bool SetAllowedTokens(std::span<const int> tokens);
+
+  // Use a fixed seed for sampling, 0 means random.
+  void Seed(unsigned int seed) { sampler_.Seed(seed); }
+
+  // Stream the weights of decoders from the checkpoint, for models larger than
+  // memory. Return false if the model is not loaded from a checkpoint.
+  bool EnableLayerStreaming() { return model_->EnableLayerStreaming(); }
+
+  // Run the decoders of the model in |stages| pipeline stages on their own
+  // threads, which speeds up the passes of many tokens. The threads are
+  // pinned to |cpus| in order when not empty.
+  void EnablePipeline(size_t stages, std::span<const int> cpus = {}) {
+    model_->EnablePipeline(stages, cpus);
+  }
+
+  const LanguageModel& model() const { return *model_; }
+
+  // How many tokens have been fed into the model.
+  size_t position() const { return position_; }
+
+  // The last fed token.
+  int last_token() const { return last_token_; }
+
+  // Stats of speculative decoding since last Reset.
+  const SpeculationStats& speculation_stats() const { return stats_; }
+
+  int bos_id() const { return Tokenizer::kBosId; }
+  int eos_id() const { return Tokenizer::kEosId; }
+
+ private:
+  Engine() = default;
+
+  // Create an engine running |model|, return nullptr if it is null.
+  static std::unique_ptr<Engine> Create(std::unique_ptr<LanguageModel> model,
+                                        const char* tokenizer_path,
+                                        std::string* error);
+
+  // Feed at most kMaxBatchSize tokens in one forward pass.
+  void Feed(std::span<const int> tokens);
+
+  // Reset and prefill the tokens of |prompt| after BOS. Return false without
+  // feeding them if they do not fit in the model's sequence.
+  bool PrefillPrompt(std::string_view prompt);
+
+  // Decode the text of |completion| following the fed tokens.
+  void DecodeCompletion(Completion* completion);
+
+  // A token fed for scoring the |target| token following it.
+  struct ScoreRow {
+    int token;
+    int sequence;
+    size_t position;
+    int target;
+    float* log_probability;
+  };
+
+  // Feed the |rows| in batches of kMaxBatchSize, and write the log probability
+  // of each target.
+  void ScoreRows(std::span<const ScoreRow> rows);
+
+  std::unique_ptr<Tokenizer> tokenizer_;
+  std::unique_ptr<Detokenizer> detokenizer_;
+  std::unique_ptr<LanguageModel> model_;
+  Sampler sampler_;
+
+  // The logits computed by the last forward pass.
+  std::span<float> logits_;
+
+  // The tokens fed into the model.
+  std::vector<int> tokens_;
+  size_t position_ = 0;
+  int last_token_ = -1;
+
+  // Speculative decoding.
+  std::unique_ptr<Drafter> drafter_;
+  size_t max_draft_ = 0;
+  SpeculationStats stats_;
+  // Reused buffers of the drafts and the tokens to generate.
+  std::vector<int> drafts_;
+  std::vector<float> draft_probabilities_;
+  std::vector<int> batch_;
+  std::vector<int> pending_;
+
+  // Reused buffer of the decoded text.
+  std::string piece_;
+};
@@ -1,21 +1,9 @@
 #include "src/feed_forward.h"
+#include "src/trace.h"
 
-namespace {
-
-constexpr
-std::array<float, kLayersSize * kHiddenDim * kEmbeddingSize> kFFNWeights1 = {
-#include "w1.inc"
-};
-
-constexpr
-std::array<float, kLayersSize * kEmbeddingSize * kHiddenDim> kFFNWeights2 = {
-#include "w2.inc"
-};
+#include "models.h"  // generated header
 
-constexpr
-std::array<float, kLayersSize * kHiddenDim * kEmbeddingSize> kFFNWeights3 = {
-#include "w3.inc"
-};
+namespace {
 
 // The swish activation function.
 // What it does is to convert negative elements to a number between (-1, 0)
@@ -23,28 +11,44 @@ std::array<float, kLayersSize * kHiddenDim * kEmbeddingSize> kFFNWeights3 = {
 // With the activation function the linear tranformation becomes non-linear and
 // the neutral networks becomes deeper.
 template<size_t N>
-void Swish(TensorF<N>* x) {
-  for (auto& val : *x)
+void Swish(MutableTensorViewF<N> x) {
+  PROFILE_OP(kSwish, sizeof(float) * N * 2);
+  for (auto& val : x)
     val /= 1.f + std::exp(-val);
 }
 
 }  // namespace
 
-FeedForward::FeedForward(int layer)
-    : w1_(kFFNWeights1, layer * kHiddenDim * kEmbeddingSize),
-      w2_(kFFNWeights2, layer * kEmbeddingSize * kHiddenDim),
-      w3_(kFFNWeights3, layer * kHiddenDim * kEmbeddingSize) {}
-
-TensorF<kEmbeddingSize> FeedForward::Forward(TensorF<kEmbeddingSize> x) const {
+template<typename C>
+FeedForward<C>::FeedForward(const ModelWeights<C>& weights, int layer)
+    : w1_(weights.w1[layer]),
+      w2_(weights.w2[layer]),
+      w3_(weights.w3[layer]) {}
+
+template<typename C>
+void FeedForward<C>::Forward(
+    TensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+    size_t count,
+    Workspace<C>* workspace,
+    MutableTensorViewF<kMaxBatchSize, C::kEmbeddingSize> residual) const {
+  TRACE_EVENT("FeedForward");
   // Compute a "gate" hidden state with swish activation.
-  TensorF<kHiddenDim> gate = MatrixProduct(w1_, x);
-  Swish(&gate);
+  TensorF<kMaxBatchSize, C::kHiddenDim>& gate = workspace->gate;
+  BatchMatrixProductTo(w1_, x, count, &gate);
+  for (size_t b = 0; b < count; ++b)
+    Swish(gate[b]);
   // Compute another hidden state.
-  TensorF<kHiddenDim> h = MatrixProduct(w3_, x);
+  TensorF<kMaxBatchSize, C::kHiddenDim>& h = workspace->hidden;
+  BatchMatrixProductTo(w3_, x, count, &h);
   // Multiply the elements of hidden state with the gates, intuitively this
   // controls how data in attention are filtered.
-  for (size_t i = 0; i < kHiddenDim; ++i)
-    h[i] *= gate[i];
-  // Convert the hidden state into embedding.
-  return MatrixProduct(w2_, h);
+  for (size_t b = 0; b < count; ++b) {
+    for (size_t i = 0; i < C::kHiddenDim; ++i)
+      h[b][i] *= gate[b][i];
+  }
+  // Convert the hidden state into embedding and add it to the residual stream.
+  BatchMatrixProductAddTo(w2_, h, count, &residual);
 }
+
+#define INSTANTIATE_FEED_FORWARD(C) template class FeedForward<C>;
+FROST_FOR_EACH_MODEL(INSTANTIATE_FEED_FORWARD)
@@ -1,15 +1,25 @@
-#include "src/model_common.h"
+#pragma once
+
+#include "src/model_weights.h"
+#include "src/workspace.h"
 
 // The FeedForward layer implements a SwiGLU (Swish Gated Linear Unit).
+template<typename C>
 class FeedForward {
  public:
-  explicit FeedForward(int layer);
+  FeedForward(const ModelWeights<C>& weights, int layer);
 
-  TensorF<kEmbeddingSize> Forward(TensorF<kEmbeddingSize> x) const;
+  // Transform the first |count| rows of |x| and add the results to
+  // |residual|, the temporary tensors are stored in |workspace|.
+  void Forward(TensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+               size_t count,
+               Workspace<C>* workspace,
+               MutableTensorViewF<kMaxBatchSize, C::kEmbeddingSize> residual)
+      const;
 
  private:
   // The model weights.
-  const TensorViewF<kHiddenDim, kEmbeddingSize> w1_;
-  const TensorViewF<kEmbeddingSize, kHiddenDim> w2_;
-  const TensorViewF<kHiddenDim, kEmbeddingSize> w3_;
+  const TensorViewF<C::kHiddenDim, C::kEmbeddingSize> w1_;
+  const TensorViewF<C::kEmbeddingSize, C::kHiddenDim> w2_;
+  const TensorViewF<C::kHiddenDim, C::kEmbeddingSize> w3_;
 };
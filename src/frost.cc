@@ -0,0 +1,219 @@
+#include "src/frost.h"
+
+#include <algorithm>
+
+#include "src/engine.h"
+#include "src/large_buffer.h"
+
+struct frost_engine {
+  std::unique_ptr<Engine> engine;
+};
+
+namespace {
+
+std::string& LastError() {
+  static thread_local std::string error;
+  return error;
+}
+
+size_t ReportCompletions(const std::vector<Engine::Completion>& completions,
+                         frost_completion_callback callback,
+                         void* user_data) {
+  for (const Engine::Completion& completion : completions) {
+    callback(completion.tokens.data(), completion.tokens.size(),
+             completion.text.data(), completion.text.size(),
+             completion.log_probability, user_data);
+  }
+  return completions.size();
+}
+
+}  // namespace
+
+frost_engine* frost_engine_create(const char* tokenizer_path) {
+  return frost_engine_create_with_model("", tokenizer_path);
+}
+
+frost_engine* frost_engine_create_with_model(const char* model,
+                                             const char* tokenizer_path) {
+  std::unique_ptr<Engine> engine = Engine::Create(model, tokenizer_path,
+                                                  &LastError());
+  if (!engine)
+    return nullptr;
+  return new frost_engine{std::move(engine)};
+}
+
+frost_engine* frost_engine_create_shard(const char* model,
+                                        const char* tokenizer_path,
+                                        const char* address,
+                                        size_t rank,
+                                        size_t ranks) {
+  std::unique_ptr<Communicator> communicator =
+      Communicator::Create(address, rank, ranks, &LastError());
+  if (!communicator)
+    return nullptr;
+  std::unique_ptr<Engine> engine = Engine::CreateShard(
+      model, tokenizer_path, std::move(communicator), &LastError());
+  if (!engine)
+    return nullptr;
+  return new frost_engine{std::move(engine)};
+}
+
+void frost_engine_destroy(frost_engine* engine) {
+  delete engine;
+}
+
+int frost_use_draft_model(frost_engine* engine,
+                          const char* model,
+                          size_t max_draft) {
+  return engine->engine->UseDraftModel(model, max_draft, &LastError());
+}
+
+const char* frost_last_error(void) {
+  return LastError().c_str();
+}
+
+int frost_publish_weights(const char* model, const char* name) {
+  return LanguageModel::PublishWeights(model, name, &LastError());
+}
+
+int frost_unpublish_weights(const char* name) {
+  return LanguageModel::UnpublishWeights(name);
+}
+
+void frost_set_numa_interleave(int interleave) {
+  LargeBuffer::SetNumaInterleave(interleave);
+}
+
+int frost_enable_layer_streaming(frost_engine* engine) {
+  return engine->engine->EnableLayerStreaming();
+}
+
+void frost_enable_pipeline(frost_engine* engine, size_t stages) {
+  engine->engine->EnablePipeline(stages);
+}
+
+void frost_enable_pipeline_on_cpus(frost_engine* engine,
+                                   size_t stages,
+                                   const int* cpus,
+                                   size_t count) {
+  engine->engine->EnablePipeline(stages, {cpus, count});
+}
+
+void frost_seed(frost_engine* engine, unsigned int seed) {
+  engine->engine->Seed(seed);
+}
+
+size_t frost_tokenize(frost_engine* engine,
+                      const char* text,
+                      int add_bos,
+                      int* tokens,
+                      size_t capacity) {
+  std::vector<int> result = engine->engine->Tokenize(text, add_bos != 0);
+  std::copy_n(result.begin(), std::min(capacity, result.size()), tokens);
+  return result.size();
+}
+
+int frost_prefill(frost_engine* engine, const int* tokens, size_t count) {
+  if (engine->engine->position() + count > frost_max_sequence_length(engine))
+    return 0;
+  engine->engine->Prefill(std::span<const int>(tokens, count));
+  return 1;
+}
+
+int frost_step(frost_engine* engine, int token) {
+  return frost_prefill(engine, &token, 1);
+}
+
+int frost_sample(frost_engine* engine, float top_p) {
+  return engine->engine->Sample(top_p);
+}
+
+int frost_set_allowed_tokens(frost_engine* engine,
+                             const int* tokens,
+                             size_t count) {
+  return engine->engine->SetAllowedTokens(std::span<const int>(tokens, count));
+}
+
+void frost_reset(frost_engine* engine) {
+  engine->engine->Reset();
+}
+
+size_t frost_position(frost_engine* engine) {
+  return engine->engine->position();
+}
+
+size_t frost_max_sequence_length(frost_engine* engine) {
+  return engine->engine->model().shape().sequence_size;
+}
+
+size_t frost_embedding_size(frost_engine* engine) {
+  return engine->engine->model().shape().embedding_size;
+}
+
+int frost_bos_id(frost_engine* engine) {
+  return engine->engine->bos_id();
+}
+
+int frost_eos_id(frost_engine* engine) {
+  return engine->engine->eos_id();
+}
+
+size_t frost_generate(frost_engine* engine,
+                      const char* prompt,
+                      size_t max_tokens,
+                      float top_p,
+                      frost_token_callback callback,
+                      void* user_data) {
+  return engine->engine->Generate(
+      prompt, max_tokens, top_p,
+      [callback, user_data](int token, std::string_view piece) {
+        return callback(token, piece.data(), piece.size(), user_data) != 0;
+      });
+}
+
+size_t frost_generate_samples(frost_engine* engine,
+                              const char* prompt,
+                              size_t n,
+                              size_t max_tokens,
+                              float top_p,
+                              frost_completion_callback callback,
+                              void* user_data) {
+  return ReportCompletions(
+      engine->engine->GenerateSamples(prompt, n, max_tokens, top_p),
+      callback, user_data);
+}
+
+size_t frost_beam_search(frost_engine* engine,
+                         const char* prompt,
+                         size_t beam_width,
+                         size_t max_tokens,
+                         frost_completion_callback callback,
+                         void* user_data) {
+  return ReportCompletions(
+      engine->engine->BeamSearch(prompt, beam_width, max_tokens),
+      callback, user_data);
+}
+
+size_t frost_score_text(frost_engine* engine,
+                        const char* text,
+                        float* log_probabilities,
+                        size_t capacity) {
+  std::vector<float> result = engine->engine->ScoreText(text);
+  std::copy_n(result.begin(), std::min(capacity, result.size()),
+              log_probabilities);
+  return result.size();
+}
+
+void frost_embed(frost_engine* engine,
+                 const char* const* texts,
+                 size_t count,
+                 int pooling,
+                 float* embeddings) {
+  std::vector<std::string> inputs(texts, texts + count);
+  auto result = engine->engine->Embed(
+      inputs,
+      pooling == FROST_POOLING_LAST ? Engine::Pooling::kLast
+                                    : Engine::Pooling::kMean);
+  for (const std::vector<float>& embedding : result)
+    embeddings = std::copy(embedding.begin(), embedding.end(), embeddings);
+}
@@ -0,0 +1,197 @@
+/* The C API of libfrost. */
+
+#ifndef FROST_H_
+#define FROST_H_
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#if defined(FROST_IMPLEMENTATION)
+#define FROST_EXPORT __declspec(dllexport)
+#else
+#define FROST_EXPORT
+#endif
+#else
+#define FROST_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct frost_engine frost_engine;
+
+/* Called for each generated token with the decoded text, which is not
+ * null-terminated. Return 0 to stop the generation. When the text ends with
+ * an incomplete UTF-8 character, it is called once more with the EOS token
+ * and U+FFFD. */
+typedef int (*frost_token_callback)(int token,
+                                    const char* piece,
+                                    size_t piece_length,
+                                    void* user_data);
+
+/* Called with each completion returned by frost_generate_samples and
+ * frost_beam_search, |log_probability| is the sum of the log probabilities of
+ * its tokens. */
+typedef void (*frost_completion_callback)(const int* tokens,
+                                          size_t tokens_length,
+                                          const char* text,
+                                          size_t text_length,
+                                          float log_probability,
+                                          void* user_data);
+
+/* Load the first compiled model and the tokenizer, return NULL on failure. */
+FROST_EXPORT frost_engine* frost_engine_create(const char* tokenizer_path);
+/* Same as frost_engine_create but load the compiled model with |model| name. */
+FROST_EXPORT frost_engine* frost_engine_create_with_model(
+    const char* model, const char* tokenizer_path);
+/* Same as frost_engine_create but load the shard of llama2.c checkpoint
+ * |model| for |rank| of |ranks| processes in tensor parallel inference, which
+ * connect to each other at |address|, i.e. "shm:<name>" for shared memory.
+ * All the processes must make the same calls with the same seed. */
+FROST_EXPORT frost_engine* frost_engine_create_shard(
+    const char* model, const char* tokenizer_path, const char* address,
+    size_t rank, size_t ranks);
+FROST_EXPORT void frost_engine_destroy(frost_engine* engine);
+
+/* Use the compiled model or llama2.c checkpoint |model| to propose at most
+ * |max_draft| tokens for speculative decoding in frost_generate, or "ngram" to
+ * propose by looking up n-grams in the sequence, or "early-exit:L" to propose
+ * with the first L layers of the model. Return 0 on failure, and the error can
+ * be read with frost_last_error. */
+FROST_EXPORT int frost_use_draft_model(frost_engine* engine,
+                                       const char* model,
+                                       size_t max_draft);
+
+/* Return the error of last failed frost_engine_create,
+ * frost_engine_create_shard, frost_use_draft_model or frost_publish_weights
+ * call. */
+FROST_EXPORT const char* frost_last_error(void);
+
+/* Copy the weights of the compiled model or llama2.c checkpoint |model| into
+ * the shared memory object |name|, then engines created with the model
+ * "shm:<name>" in any process share one copy of the weights. Return 0 on
+ * failure, and the error can be read with frost_last_error. */
+FROST_EXPORT int frost_publish_weights(const char* model, const char* name);
+/* Remove the weights published as |name|, return 0 if there is none. */
+FROST_EXPORT int frost_unpublish_weights(const char* name);
+
+/* Interleave the pages of the KV cache, and of the weights loaded with the
+ * model "copy:<path>", of the engines created after this call over the NUMA
+ * nodes on Linux, when |interleave| is not 0. */
+FROST_EXPORT void frost_set_numa_interleave(int interleave);
+
+/* Stream the weights of decoders from the checkpoint file instead of keeping
+ * them in memory, for models larger than memory. Return 0 if the model is not
+ * loaded from a checkpoint. */
+FROST_EXPORT int frost_enable_layer_streaming(frost_engine* engine);
+
+/* Run the decoders in |stages| pipeline stages on their own threads, which
+ * speeds up the passes of many tokens like prefilling, 1 disables it. */
+FROST_EXPORT void frost_enable_pipeline(frost_engine* engine, size_t stages);
+
+/* Same with frost_enable_pipeline, but pin the thread of stage i to the CPU
+ * |cpus[i]| on Linux, for the |count| first stages. */
+FROST_EXPORT void frost_enable_pipeline_on_cpus(frost_engine* engine,
+                                                size_t stages,
+                                                const int* cpus,
+                                                size_t count);
+
+/* Use a fixed seed for sampling, 0 means random. */
+FROST_EXPORT void frost_seed(frost_engine* engine, unsigned int seed);
+
+/* Convert |text| to tokens and write at most |capacity| of them to |tokens|.
+ * Return the number of tokens the text has, which may be larger than
+ * |capacity|. */
+FROST_EXPORT size_t frost_tokenize(frost_engine* engine,
+                                   const char* text,
+                                   int add_bos,
+                                   int* tokens,
+                                   size_t capacity);
+
+/* Feed tokens into the model, return 0 if the sequence would be too long. */
+FROST_EXPORT int frost_prefill(frost_engine* engine,
+                               const int* tokens,
+                               size_t count);
+FROST_EXPORT int frost_step(frost_engine* engine, int token);
+
+/* Pick the next token after a frost_prefill or frost_step call. */
+FROST_EXPORT int frost_sample(frost_engine* engine, float top_p);
+
+/* Only allow sampling the |count| |tokens| after next frost_prefill or
+ * frost_step call, and only compute their logits, or allow all tokens when
+ * |count| is 0. Return 0 if a token is not in the vocabulary. */
+FROST_EXPORT int frost_set_allowed_tokens(frost_engine* engine,
+                                          const int* tokens,
+                                          size_t count);
+
+/* Forget the current sequence. */
+FROST_EXPORT void frost_reset(frost_engine* engine);
+
+/* Return how many tokens have been fed into the model. */
+FROST_EXPORT size_t frost_position(frost_engine* engine);
+FROST_EXPORT size_t frost_max_sequence_length(frost_engine* engine);
+FROST_EXPORT size_t frost_embedding_size(frost_engine* engine);
+
+FROST_EXPORT int frost_bos_id(frost_engine* engine);
+FROST_EXPORT int frost_eos_id(frost_engine* engine);
+
+/* Generate text for |prompt| and stream each token to |callback|. Return the
+ * number of generated tokens, which is 0 when the prompt is longer than
+ * frost_max_sequence_length. */
+FROST_EXPORT size_t frost_generate(frost_engine* engine,
+                                   const char* prompt,
+                                   size_t max_tokens,
+                                   float top_p,
+                                   frost_token_callback callback,
+                                   void* user_data);
+
+/* Sample |n| completions of |prompt| which decode in parallel, and pass each
+ * one to |callback|. Return the number of completions, which is 0 when the
+ * prompt is longer than frost_max_sequence_length. */
+FROST_EXPORT size_t frost_generate_samples(frost_engine* engine,
+                                           const char* prompt,
+                                           size_t n,
+                                           size_t max_tokens,
+                                           float top_p,
+                                           frost_completion_callback callback,
+                                           void* user_data);
+
+/* Search the most likely completions of |prompt| with |beam_width| beams, and
+ * pass them to |callback| from the most likely one. Return the number of
+ * completions, which is 0 when the prompt is longer than
+ * frost_max_sequence_length. */
+FROST_EXPORT size_t frost_beam_search(frost_engine* engine,
+                                      const char* prompt,
+                                      size_t beam_width,
+                                      size_t max_tokens,
+                                      frost_completion_callback callback,
+                                      void* user_data);
+
+/* How frost_embed pools the hidden states of the tokens of a text. */
+#define FROST_POOLING_MEAN 0
+#define FROST_POOLING_LAST 1
+
+/* Write the embeddings of the |count| |texts| to |embeddings|, which must have
+ * space for count * frost_embedding_size floats. The embedding of a text is the
+ * hidden states of its tokens after the final normalization, pooled by the
+ * mean of all tokens or by the last token. */
+FROST_EXPORT void frost_embed(frost_engine* engine,
+                              const char* const* texts,
+                              size_t count,
+                              int pooling,
+                              float* embeddings);
+
+/* Write the log probability of each token of |text| given the tokens before it
+ * to |log_probabilities|, at most |capacity| of them. Return the number of
+ * scored tokens, which may be larger than |capacity|. */
+FROST_EXPORT size_t frost_score_text(frost_engine* engine,
+                                     const char* text,
+                                     float* log_probabilities,
+                                     size_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* FROST_H_ */
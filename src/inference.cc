@@ -1,121 +1,448 @@
 #include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
-#include <random>
+#include <limits>
+#include <sstream>
 
-#include "src/embedding.h"
-#include "src/transformer.h"
-#include "third_party/sentencepiece/src/sentencepiece_processor.h"
+#include "src/benchmark.h"
+#include "src/engine.h"
+#include "src/large_buffer.h"
+#include "src/trace.h"
 
 namespace {
 
-// Return an index of element using top-p algorithm.
-template<size_t N>
-int SampleTopP(TensorViewF<N> probabilities, float p) {
-  static_assert(N > 2);
-  // Ignore the probability if it is less than cutoff.
-  float cutoff = (1.f - p) / (N - 1);
-  // Sort the elements of probabilities into a new vector.
-  std::vector<std::pair<float, size_t>> sorted;
-  for (size_t i = 0; i < N; i++) {
-    if (probabilities[i] >= cutoff)
-      sorted.push_back({probabilities[i], i});
-  }
-  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
-    return a.first > b.first;
-  });
-  CHECK_GT(sorted.size(), 0);
-
-  // Calculate cumulative probabilities.
-  float total = 0.f;
-  size_t index = sorted.size() - 1;
-  for (size_t i = 0; i < sorted.size(); i++) {
-    total += sorted[i].first;
-    if (total >= p) {
-      index = i;
-      break;
+void PrintUsage() {
+  std::cerr << "Usage: frost_run [options]\n"
+               "Example: frost_run -n 256 -i \"Once upon a time\"\n"
+               "Options:\n"
+               "  -p <float>  p value in top-p sampling, default 0.9\n"
+               "  -s <int>    random seed, default random\n"
+               "  -n <int>    number of steps to run for, default max\n"
+               "  -i <string> input prompt\n"
+               "  -z <string> path to tokenizer, default "
+               "assets/tokenizer.bin\n"
+               "  -m <string> mode: generate|benchmark|perplexity|score|embed|"
+               "publish|\n"
+               "              unpublish, default: generate\n"
+               "  -f <string> input file of perplexity mode, or of score mode "
+               "with a\n"
+               "              context and a continuation separated by tab in "
+               "each line,\n"
+               "              or of embed mode with a text in each line\n"
+               "  -o <string> name of the shared memory to publish the weights "
+               "of -w to,\n"
+               "              or to unpublish, the weights are loaded with -w "
+               "shm:<name>\n"
+               "  -e <string> pooling of embed mode: mean|last, default mean\n"
+               "  -a <string> only generate the tokens of this text and EOS\n"
+               "  -l <int>    1 to stream the decoder weights of checkpoint "
+               "from disk, for\n"
+               "              models larger than memory, default 0\n"
+               "  -u <int>    1 to interleave the pages of KV cache and of "
+               "weights loaded\n"
+               "              with copy: over the NUMA nodes, default 0\n"
+               "  -j <string> number of pipeline stages to run the decoders "
+               "in, each one\n"
+               "              on its own thread, default 1, with the CPUs to "
+               "pin them to as\n"
+               "              <stages>:<cpu>,<cpu>,...\n"
+               "  -x <string> run the shard of -w checkpoint for a rank of "
+               "tensor parallel\n"
+               "              inference as <rank>:<ranks>:shm:<name>, all "
+               "ranks need the\n"
+               "              same options and -s, only rank 0 prints\n"
+               "  -t <string> path to write a Chrome trace of the run, see "
+               "src/trace.h\n"
+               "  -d <string> draft model for speculative decoding, same "
+               "format with -w,\n"
+               "              or \"ngram\" to draft by looking up the prompt "
+               "and output,\n"
+               "              or \"early-exit:<int>\" to draft with the first "
+               "layers of -w\n"
+               "  -k <int>    number of draft tokens for each pass, default 4\n"
+               "  -c <int>    number of completions to sample in parallel\n"
+               "  -b <int>    beam width, print the best completions found by "
+               "beam search\n"
+               "  -w <string> path to llama2.c checkpoint, prefixed with copy: "
+               "to copy the\n"
+               "              weights into huge pages instead of mapping the "
+               "file, or name\n"
+               "              of compiled model, default the first one of:";
+  for (const char* name : LanguageModel::Names())
+    std::cerr << " " << name;
+  std::cerr << std::endl;
+}
+
+// Print the perplexity of the text in |path|.
+int RunPerplexity(Engine* engine, const char* path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    std::cerr << "Failed to read " << path << std::endl;
+    return 2;
+  }
+  std::stringstream text;
+  text << file.rdbuf();
+
+  auto start_time = std::chrono::high_resolution_clock::now();
+  std::vector<float> log_probabilities = engine->ScoreText(text.str());
+  auto end_time = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<float> elapsed = end_time - start_time;
+
+  double log_likelihood = 0;
+  for (float log_probability : log_probabilities)
+    log_likelihood += log_probability;
+  size_t count = log_probabilities.size();
+  std::cout << "tokens: " << count
+            << ", log likelihood: " << log_likelihood
+            << ", perplexity: "
+            << (count ? std::exp(-log_likelihood / count) : 0)
+            << ", scored tok/s: " << count / elapsed.count() << std::endl;
+  return 0;
+}
+
+// Print the log likelihood and the number of tokens of the continuation in
+// each line of |path|. Consecutive lines with the same context share the KV
+// cache of the context.
+int RunScore(Engine* engine, const char* path) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Failed to read " << path << std::endl;
+    return 2;
+  }
+  std::string context;
+  std::vector<std::string> continuations;
+  auto score_group = [&]() {
+    if (continuations.empty())
+      return;
+    auto scores = engine->ScoreContinuations(context, continuations);
+    for (size_t i = 0; i < continuations.size(); ++i) {
+      double log_likelihood = 0;
+      for (float log_probability : scores[i])
+        log_likelihood += log_probability;
+      std::cout << log_likelihood << "\t" << scores[i].size() << "\t"
+                << context << "\t" << continuations[i] << std::endl;
+    }
+    continuations.clear();
+  };
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t tab = line.find('\t');
+    if (tab == std::string::npos) {
+      std::cerr << "Expected a tab in line: " << line << std::endl;
+      return 1;
     }
+    std::string_view line_context = std::string_view(line).substr(0, tab);
+    if (line_context != context)
+      score_group();
+    context = line_context;
+    continuations.push_back(line.substr(tab + 1));
+  }
+  score_group();
+  return 0;
+}
+
+// Print the embedding of the text in each line of |path|.
+int RunEmbed(Engine* engine, const char* path, Engine::Pooling pooling) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Failed to read " << path << std::endl;
+    return 2;
   }
+  std::vector<std::string> texts;
+  std::string line;
+  while (std::getline(file, line))
+    texts.push_back(std::move(line));
 
-  // Get a random number between 0 and 1.
-  static std::random_device device;
-  static std::default_random_engine engine(device());
-  std::uniform_real_distribution<float> uniform_dist(0.f, 1.f);
-  float random = uniform_dist(engine);
+  auto start_time = std::chrono::high_resolution_clock::now();
+  std::vector<std::vector<float>> embeddings = engine->Embed(texts, pooling);
+  auto end_time = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<float> elapsed = end_time - start_time;
 
-  // Cumulative distribution function.
-  float r = random * total;
-  float cdf = 0.f;
-  for (size_t i = 0; i <= index; i++) {
-    cdf += sorted[i].first;
-    if (r < cdf)
-      return sorted[i].second;
+  for (const std::vector<float>& embedding : embeddings) {
+    for (size_t i = 0; i < embedding.size(); ++i)
+      std::cout << (i == 0 ? "" : " ") << embedding[i];
+    std::cout << std::endl;
   }
-  return sorted[index].second;
+  std::cerr << "achieved texts/s: " << texts.size() / elapsed.count()
+            << std::endl;
+  return 0;
+}
+
+// Parse |text| of "<stages>" or "<stages>:<cpu>,<cpu>,...". Return false if
+// it is malformed.
+bool ParsePipeline(const char* text, size_t* stages, std::vector<int>* cpus) {
+  char* end;
+  *stages = strtoul(text, &end, 10);
+  cpus->clear();
+  if (end == text)
+    return false;
+  if (*end == '\0')
+    return true;
+  if (*end != ':')
+    return false;
+  do {
+    const char* cpu = end + 1;
+    cpus->push_back(strtol(cpu, &end, 10));
+    if (end == cpu || cpus->back() < 0)
+      return false;
+  } while (*end == ',');
+  return *end == '\0';
 }
 
 }  // namespace
 
 int main(int argc, const char *argv[]) {
-  // Load llama2 sentencepiece model.
-  sentencepiece::SentencePieceProcessor processor;
-  const auto status = processor.Load("assets/tokenizer.model");
-  if (!status.ok()) {
-    std::cerr << "Failed to load tokenizer: " << status.ToString() << std::endl;
-    return 1;
+  float top_p = 0.9;
+  unsigned int seed = 0;
+  size_t steps = std::numeric_limits<size_t>::max();
+  const char* prompt = "";
+  const char* tokenizer_path = "assets/tokenizer.bin";
+  const char* mode = "generate";
+  const char* model = "";
+  const char* trace_path = nullptr;
+  const char* draft_model = nullptr;
+  const char* input_path = nullptr;
+  const char* shared_name = nullptr;
+  const char* pooling = "mean";
+  const char* allowed_text = nullptr;
+  bool layer_streaming = false;
+  size_t pipeline_stages = 1;
+  std::vector<int> pipeline_cpus;
+  const char* shard = nullptr;
+  size_t max_draft = 4;
+  size_t completions = 0;
+  size_t beam_width = 0;
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2) {
+      PrintUsage();
+      return 1;
+    }
+    switch (argv[i][1]) {
+      case 'p': top_p = atof(argv[i + 1]); break;
+      case 's': seed = atoi(argv[i + 1]); break;
+      case 'n': steps = atoi(argv[i + 1]); break;
+      case 'i': prompt = argv[i + 1]; break;
+      case 'z': tokenizer_path = argv[i + 1]; break;
+      case 'm': mode = argv[i + 1]; break;
+      case 'f': input_path = argv[i + 1]; break;
+      case 'o': shared_name = argv[i + 1]; break;
+      case 'e': pooling = argv[i + 1]; break;
+      case 'a': allowed_text = argv[i + 1]; break;
+      case 'l': layer_streaming = atoi(argv[i + 1]) != 0; break;
+      case 'u': LargeBuffer::SetNumaInterleave(atoi(argv[i + 1])); break;
+      case 'j':
+        if (!ParsePipeline(argv[i + 1], &pipeline_stages, &pipeline_cpus)) {
+          PrintUsage();
+          return 1;
+        }
+        break;
+      case 'x': shard = argv[i + 1]; break;
+      case 't': trace_path = argv[i + 1]; break;
+      case 'w': model = argv[i + 1]; break;
+      case 'd': draft_model = argv[i + 1]; break;
+      case 'k': max_draft = atoi(argv[i + 1]); break;
+      case 'c': completions = atoi(argv[i + 1]); break;
+      case 'b': beam_width = atoi(argv[i + 1]); break;
+      default:
+        PrintUsage();
+        return 1;
+    }
   }
-  if (processor.GetPieceSize() != kTokensSize) {
-    return 2;
+
+  if (trace_path && !trace::Start(trace_path)) {
+    std::cerr << "Tracing is not enabled, build with frost_enable_tracing."
+              << std::endl;
+    trace_path = nullptr;
   }
 
-  Transformer transformer;
+  if (strcmp(mode, "benchmark") == 0) {
+    if (shard) {
+      std::cerr << "Tensor parallel is not supported in benchmark mode."
+                << std::endl;
+      return 1;
+    }
+    BenchmarkOptions options;
+    options.model = model;
+    if (draft_model)
+      options.draft_model = draft_model;
+    options.max_draft = max_draft;
+    options.layer_streaming = layer_streaming;
+    options.pipeline_stages = pipeline_stages;
+    options.pipeline_cpus = pipeline_cpus;
+    options.tokenizer_path = tokenizer_path;
+    if (*prompt) {
+      options.prompts = {prompt};
+    } else {
+      // Fixed prompts of different lengths.
+      options.prompts = {
+        "",
+        "Once upon a time",
+        "Lily and Ben were best friends. They liked to play in the park "
+        "every day. One day, they found a big red ball under a tree.",
+      };
+    }
+    options.steps = steps;
+    options.top_p = top_p;
+    // Use a fixed seed so results are reproducible.
+    options.seed = seed ? seed : 42;
+    int result = RunBenchmark(options);
+    if (trace_path && !trace::Stop())
+      std::cerr << "Failed to write trace to " << trace_path << std::endl;
+    return result;
+  }
+  bool publish = strcmp(mode, "publish") == 0;
+  if (publish || strcmp(mode, "unpublish") == 0) {
+    if (!shared_name) {
+      std::cerr << "The " << mode << " mode requires a name." << std::endl;
+      return 1;
+    }
+    if (!publish) {
+      if (!LanguageModel::UnpublishWeights(shared_name)) {
+        std::cerr << "No weights published as " << shared_name << std::endl;
+        return 2;
+      }
+      return 0;
+    }
+    std::string error;
+    if (!LanguageModel::PublishWeights(model, shared_name, &error)) {
+      std::cerr << error << std::endl;
+      return 2;
+    }
+    return 0;
+  }
 
-  // Get the token for a single character "i", the character itself does not
-  // have any meaning. See Decode code below for more.
-  std::vector<int> dummy;
-  processor.Encode("i", &dummy);
+  bool perplexity = strcmp(mode, "perplexity") == 0;
+  bool score = strcmp(mode, "score") == 0;
+  bool embed = strcmp(mode, "embed") == 0;
+  if (strcmp(mode, "generate") != 0 && !perplexity && !score && !embed) {
+    PrintUsage();
+    return 1;
+  }
+  if (embed && strcmp(pooling, "mean") != 0 && strcmp(pooling, "last") != 0) {
+    PrintUsage();
+    return 1;
+  }
+  if ((perplexity || score || embed) && !input_path) {
+    std::cerr << "The " << mode << " mode requires an input file." << std::endl;
+    return 1;
+  }
 
-  auto start_time = std::chrono::high_resolution_clock::now();
+  std::string error;
+  std::unique_ptr<Engine> engine;
+  if (shard) {
+    // All ranks must sample the same tokens.
+    size_t rank, ranks;
+    int address = 0;
+    if (sscanf(shard, "%zu:%zu:%n", &rank, &ranks, &address) != 2 ||
+        address == 0 || seed == 0) {
+      PrintUsage();
+      return 1;
+    }
+    std::unique_ptr<Communicator> communicator =
+        Communicator::Create(shard + address, rank, ranks, &error);
+    if (communicator) {
+      engine = Engine::CreateShard(model, tokenizer_path,
+                                   std::move(communicator), &error);
+    }
+    // The other ranks compute the same outputs.
+    if (rank != 0)
+      std::cout.setstate(std::ios::failbit);
+  } else {
+    engine = Engine::Create(model, tokenizer_path, &error);
+  }
+  if (!engine) {
+    std::cerr << error << std::endl;
+    return 2;
+  }
+  if (draft_model && !engine->UseDraftModel(draft_model, max_draft, &error)) {
+    std::cerr << error << std::endl;
+    return 2;
+  }
+  if (layer_streaming && !engine->EnableLayerStreaming()) {
+    std::cerr << "Layer streaming requires a checkpoint file." << std::endl;
+    return 2;
+  }
+  engine->EnablePipeline(pipeline_stages, pipeline_cpus);
+  engine->Seed(seed);
+  if (allowed_text) {
+    std::vector<int> allowed = engine->Tokenize(allowed_text, false);
+    allowed.push_back(engine->eos_id());
+    engine->SetAllowedTokens(allowed);
+  }
 
-  // Start feeding tokens into transformer, the first token is always BOS.
-  int token = processor.bos_id();
-  size_t position = 0;
-  while (position < kSequenceSize) {
-    // Encode the token into an embedding and feed it to transformer.
-    TensorF<kTokensSize> logits = transformer.Forward(Encode(token), position);
-    Softmax(logits.begin(), logits.end());
-
-    // Sample the result to predict the next token.
-    token = SampleTopP(logits.View(), 0.9);
-
-    // End of sequence.
-    if (token == processor.eos_id() || token == processor.bos_id())
-      break;
-
-    // Decode the token into text.
-    std::string piece;
-    std::string_view result;
-    if (position == 0) {
-      processor.Decode({token}, &piece);
-      result = piece;
+  if (perplexity || score || embed) {
+    int result;
+    if (perplexity) {
+      result = RunPerplexity(engine.get(), input_path);
+    } else if (score) {
+      result = RunScore(engine.get(), input_path);
     } else {
-      // When decoding, sentencepiece strips the leading spaces for the first
-      // token, which results in all spaces getting removed when decoding token
-      // by token. We work around this by prepending a dummy token and skipping
-      // the first character in the result.
-      processor.Decode({dummy[0], token}, &piece);
-      result = std::string_view(piece.begin() + 1, piece.end());
+      result = RunEmbed(engine.get(), input_path,
+                        strcmp(pooling, "last") == 0 ? Engine::Pooling::kLast
+                                                     : Engine::Pooling::kMean);
     }
-    std::cout << result << std::flush;
+    if (trace_path && !trace::Stop())
+      std::cerr << "Failed to write trace to " << trace_path << std::endl;
+    return result;
+  }
+
+  if (engine->Tokenize(prompt, true).size() >
+      static_cast<size_t>(engine->model().shape().sequence_size)) {
+    std::cerr << "The prompt is longer than the sequence of the model."
+              << std::endl;
+    return 2;
+  }
 
-    position++;
+  if (completions > 0 || beam_width > 0) {
+    std::vector<Engine::Completion> results =
+        beam_width > 0 ? engine->BeamSearch(prompt, beam_width, steps)
+                       : engine->GenerateSamples(prompt, completions, steps,
+                                                 top_p);
+    for (const Engine::Completion& completion : results) {
+      std::cout << "[" << completion.log_probability << "] " << prompt
+                << completion.text << std::endl;
+    }
+    if (trace_path && !trace::Stop())
+      std::cerr << "Failed to write trace to " << trace_path << std::endl;
+    return 0;
   }
+
+  auto start_time = std::chrono::high_resolution_clock::now();
+
+  std::cout << prompt;
+  size_t generated = engine->Generate(
+      prompt, steps, top_p,
+      [](int token, std::string_view piece) {
+        TRACE_EVENT("Print");
+        std::cout << piece << std::flush;
+        return true;
+      });
   std::cout << std::endl;
 
   // Count time used for token generation.
   auto end_time = std::chrono::high_resolution_clock::now();
   std::chrono::duration<float> elapsed = end_time - start_time;
-  CHECK_GT(position, 0);
-  std::cout << "achieved tok/s: " << (position / elapsed.count()) << std::endl;
+  // Nothing is generated when EOS is sampled first.
+  if (generated > 0) {
+    std::cout << "achieved tok/s: " << (generated / elapsed.count())
+              << std::endl;
+  }
+  if (engine->speculative()) {
+    // Each pass emits the accepted drafts and one token sampled by the model.
+    const Engine::SpeculationStats& stats = engine->speculation_stats();
+    std::cout << "acceptance rate: "
+              << (stats.drafted ? 1.f * stats.accepted / stats.drafted : 0)
+              << ", tokens per pass: "
+              << (stats.passes ?
+                  1.f * (stats.accepted + stats.passes) / stats.passes : 0)
+              << std::endl;
+  }
+
+  if (trace_path && !trace::Stop())
+    std::cerr << "Failed to write trace to " << trace_path << std::endl;
 
   return 0;
 }
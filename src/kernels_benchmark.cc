@@ -0,0 +1,321 @@
+// Microbenchmarks of the tensor kernels, with the shapes of the compiled model
+// and of common LLaMA models.
+//
+// Usage: frost_bench [--json] [--filter <substring>] [--warmup <n>]
+//                    [--repetitions <n>]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "src/model_common.h"
+#include "src/runtime_kernels.h"
+
+#include "models.h"  // generated header
+
+namespace {
+
+struct Options {
+  bool json = false;
+  std::string filter;
+  size_t warmup = 3;
+  size_t repetitions = 30;
+};
+
+struct Result {
+  std::string kernel;
+  std::string shape;
+  std::string variant;
+  size_t iterations;
+  double median_ns;
+  double p99_ns;
+  double gflops;
+  double gbps;
+};
+
+// Prevent the compiler from optimizing away the computations on |pointer|.
+inline void DoNotOptimize(const void* pointer) {
+  asm volatile("" : : "g"(pointer) : "memory");
+}
+
+// Heap storage of a tensor filled with random numbers.
+template<size_t... N>
+class Buffer {
+ public:
+  static constexpr size_t storage_size = (N * ...);
+
+  Buffer() : data_(storage_size) {
+    static std::default_random_engine engine(42);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    for (float& f : data_)
+      f = dist(engine);
+  }
+
+  TensorViewF<N...> View() const {
+    return TensorViewF<N...>(
+        std::span<const float, storage_size>(data_.data(), storage_size));
+  }
+
+  MutableTensorViewF<N...> MutableView() {
+    std::span<float, storage_size> span(data_.data(), storage_size);
+    return MutableTensorViewF<N...>(span);
+  }
+
+  float* data() { return data_.data(); }
+
+ private:
+  std::vector<float> data_;
+};
+
+class Runner {
+ public:
+  explicit Runner(const Options& options) : options_(options) {}
+
+  // Measure |kernel|, which does |flops| floating point operations and moves
+  // |bytes| bytes each call.
+  void Run(const std::string& kernel,
+           const std::string& shape,
+           const std::string& variant,
+           double flops,
+           double bytes,
+           const std::function<void()>& function) {
+    std::string name = kernel + "/" + shape + "/" + variant;
+    if (name.find(options_.filter) == std::string::npos)
+      return;
+
+    // Calls each repetition so that a repetition takes at least 20us, which
+    // makes the timer overhead negligible for tiny kernels.
+    size_t iterations = 1;
+    for (size_t i = 0; i < options_.warmup; ++i) {
+      double ns = Measure(function, iterations) / iterations;
+      iterations = std::max<size_t>(iterations, 20000 / std::max(ns, 1.));
+    }
+
+    std::vector<double> samples;
+    for (size_t i = 0; i < options_.repetitions; ++i)
+      samples.push_back(Measure(function, iterations) / iterations);
+    std::sort(samples.begin(), samples.end());
+    double median = samples[samples.size() / 2];
+    double p99 = samples[std::min(samples.size() - 1,
+                                  samples.size() * 99 / 100)];
+    results_.push_back({kernel, shape, variant, iterations, median, p99,
+                        flops / median, bytes / median});
+    if (!options_.json) {
+      fprintf(stdout, "%-40s %12.1f %12.1f %10.2f %10.2f\n",
+              name.c_str(), median, p99, flops / median, bytes / median);
+      fflush(stdout);
+    }
+  }
+
+  void PrintHeader() {
+    if (!options_.json) {
+      fprintf(stdout, "%-40s %12s %12s %10s %10s\n",
+              "benchmark", "median(ns)", "p99(ns)", "GFLOP/s", "GB/s");
+    }
+  }
+
+  void PrintJSON() {
+    if (!options_.json)
+      return;
+    std::cout << "{\"benchmarks\": [";
+    for (size_t i = 0; i < results_.size(); ++i) {
+      const Result& r = results_[i];
+      std::cout << (i == 0 ? "\n" : ",\n")
+                << "  {\"kernel\": \"" << r.kernel << "\""
+                << ", \"shape\": \"" << r.shape << "\""
+                << ", \"variant\": \"" << r.variant << "\""
+                << ", \"iterations\": " << r.iterations
+                << ", \"repetitions\": " << options_.repetitions
+                << ", \"median_ns\": " << r.median_ns
+                << ", \"p99_ns\": " << r.p99_ns
+                << ", \"gflops\": " << r.gflops
+                << ", \"gbps\": " << r.gbps << "}";
+    }
+    std::cout << "\n]}" << std::endl;
+  }
+
+ private:
+  double Measure(const std::function<void()>& function, size_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i)
+      function();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+  }
+
+  const Options& options_;
+  std::vector<Result> results_;
+};
+
+std::string Shape(size_t n) {
+  return std::to_string(n);
+}
+
+std::string Shape(size_t n, size_t m) {
+  return std::to_string(n) + "x" + std::to_string(m);
+}
+
+// The "scalar" variant is the template specialized kernel and the "generic"
+// variant is the one used by runtime shaped models, new variants (SIMD,
+// threaded, quantized) should be added to each function below.
+
+template<size_t N, size_t M>
+void BenchmarkMatrixProduct(Runner* runner) {
+  auto matrix = std::make_unique<Buffer<N, M>>();
+  auto vector = std::make_unique<Buffer<M>>();
+  auto out = std::make_unique<Buffer<N>>();
+  runner->Run("MatrixProductTo", Shape(N, M), "scalar",
+              2. * N * M, sizeof(float) * (N * M + M + N),
+              [&]() {
+                auto result = out->MutableView();
+                frost::MatrixProductTo(matrix->View(), vector->View(),
+                                       &result);
+                DoNotOptimize(out->data());
+              });
+  runner->Run("MatrixProductTo", Shape(N, M), "generic",
+              2. * N * M, sizeof(float) * (N * M + M + N),
+              [&]() {
+                runtime::GenericMatrixProductTo(matrix->data(), vector->data(),
+                                                out->data(), N, M);
+                DoNotOptimize(out->data());
+              });
+}
+
+template<size_t N>
+void BenchmarkDotProduct(Runner* runner) {
+  auto left = std::make_unique<Buffer<N>>();
+  auto right = std::make_unique<Buffer<N>>();
+  runner->Run("DotProduct", Shape(N), "scalar",
+              2. * N, sizeof(float) * 2 * N,
+              [&]() {
+                float result = frost::DotProduct(left->View(), right->View());
+                DoNotOptimize(&result);
+              });
+}
+
+template<size_t N>
+void BenchmarkSoftmax(Runner* runner) {
+  auto x = std::make_unique<Buffer<N>>();
+  runner->Run("Softmax", Shape(N), "scalar",
+              4. * N, sizeof(float) * 2 * N,
+              [&]() {
+                Softmax(x->data(), x->data() + N);
+                DoNotOptimize(x->data());
+              });
+}
+
+template<size_t N>
+void BenchmarkRMSNormalize(Runner* runner) {
+  auto x = std::make_unique<Buffer<N>>();
+  auto weights = std::make_unique<Buffer<N>>();
+  auto out = std::make_unique<TensorF<N>>();
+  runner->Run("RMSNormalize", Shape(N), "scalar",
+              4. * N, sizeof(float) * 3 * N,
+              [&]() {
+                RMSNormalize(x->View(), weights->View(), out.get());
+                DoNotOptimize(out.get());
+              });
+}
+
+template<size_t N>
+void BenchmarkRotaryEmbeddings(Runner* runner) {
+  auto x = std::make_unique<Buffer<N>>();
+  runner->Run("ApplyRotaryEmbeddings", Shape(N), "scalar",
+              3. * N, sizeof(float) * 2 * N,
+              [&]() {
+                auto view = x->MutableView();
+                ApplyRotaryEmbeddings(7, &view);
+                DoNotOptimize(x->data());
+              });
+}
+
+// The attention of one head at the last position of a full sequence.
+template<size_t S, size_t H, size_t D>
+void BenchmarkAttention(Runner* runner) {
+  auto query = std::make_unique<Buffer<D>>();
+  auto keys = std::make_unique<Buffer<S, H, D>>();
+  auto values = std::make_unique<Buffer<S, H, D>>();
+  auto scores = std::make_unique<Buffer<S>>();
+  auto out = std::make_unique<Buffer<D>>();
+  runner->Run("AttendHead", Shape(S, D), "scalar",
+              4. * S * D, sizeof(float) * 2 * S * (D + 1),
+              [&]() {
+                AttendHead(query->View(), keys->View(), values->View(),
+                           0, S - 1, std::span<float>(scores->data(), S),
+                           out->MutableView());
+                DoNotOptimize(out->data());
+              });
+}
+
+// The shapes of a compiled model.
+template<typename C>
+void BenchmarkModel(Runner* runner) {
+  BenchmarkMatrixProduct<C::kEmbeddingSize, C::kEmbeddingSize>(runner);
+  BenchmarkMatrixProduct<C::kKVDimension, C::kEmbeddingSize>(runner);
+  BenchmarkMatrixProduct<C::kHiddenDim, C::kEmbeddingSize>(runner);
+  BenchmarkMatrixProduct<C::kEmbeddingSize, C::kHiddenDim>(runner);
+  BenchmarkMatrixProduct<C::kTokensSize, C::kEmbeddingSize>(runner);
+  BenchmarkDotProduct<C::kHeadDimension>(runner);
+  BenchmarkDotProduct<C::kEmbeddingSize>(runner);
+  BenchmarkSoftmax<C::kSequenceSize>(runner);
+  BenchmarkSoftmax<C::kTokensSize>(runner);
+  BenchmarkRMSNormalize<C::kEmbeddingSize>(runner);
+  BenchmarkRotaryEmbeddings<C::kHeadDimension>(runner);
+  BenchmarkAttention<C::kSequenceSize, C::kKVHeadsSize,
+                     C::kHeadDimension>(runner);
+}
+
+}  // namespace
+
+int main(int argc, const char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--json") == 0) {
+      options.json = true;
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      options.warmup = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+      options.repetitions = std::max(atoi(argv[++i]), 1);
+    } else {
+      std::cerr << "Usage: frost_bench [--json] [--filter <substring>] "
+                   "[--warmup <n>] [--repetitions <n>]" << std::endl;
+      return 1;
+    }
+  }
+
+  Runner runner(options);
+  runner.PrintHeader();
+
+  // Shapes of the compiled models.
+#define BENCHMARK_MODEL(C) BenchmarkModel<C>(&runner);
+  FROST_FOR_EACH_MODEL(BENCHMARK_MODEL)
+#undef BENCHMARK_MODEL
+
+  // Shapes of LLaMA 7B and 13B.
+  BenchmarkMatrixProduct<4096, 4096>(&runner);
+  BenchmarkMatrixProduct<11008, 4096>(&runner);
+  BenchmarkMatrixProduct<4096, 11008>(&runner);
+  BenchmarkMatrixProduct<32000, 4096>(&runner);
+  BenchmarkMatrixProduct<5120, 5120>(&runner);
+  BenchmarkMatrixProduct<13824, 5120>(&runner);
+  BenchmarkDotProduct<128>(&runner);
+  BenchmarkDotProduct<4096>(&runner);
+  BenchmarkSoftmax<2048>(&runner);
+  BenchmarkSoftmax<32000>(&runner);
+  BenchmarkRMSNormalize<4096>(&runner);
+  BenchmarkRMSNormalize<5120>(&runner);
+  BenchmarkRotaryEmbeddings<128>(&runner);
+  BenchmarkAttention<2048, 32, 128>(&runner);
+
+  runner.PrintJSON();
+  return 0;
+}
@@ -0,0 +1,132 @@
+#include "src/kv_cache.h"
+
+#include <algorithm>
+
+KVCache::KVCache(size_t layers, size_t kv_dimension, size_t sequence_size)
+    : layers_(layers),
+      kv_dimension_(kv_dimension),
+      max_blocks_((sequence_size + kBlockSize - 1) / kBlockSize),
+      floats_per_block_(2 * kBlockSize * kv_dimension),
+      blocks_per_chunk_(std::max<size_t>(
+          1, LargeBuffer::kHugePageSize / sizeof(float) / floats_per_block_)),
+      tables_(kMaxSequences * layers) {
+  for (Table& table : tables_) {
+    table.blocks.reserve(max_blocks_);
+    table.keys.reserve(max_blocks_);
+    table.values.reserve(max_blocks_);
+  }
+  blocks_.reserve(kMaxSequences * layers * max_blocks_);
+  free_blocks_.reserve(kMaxSequences * layers * max_blocks_);
+  for (size_t layer = 0; layer < layers; ++layer) {
+    Table& table = Get(layer, 0);
+    for (size_t i = 0; i < max_blocks_; ++i)
+      SetBlock(&table, i, Allocate());
+  }
+}
+
+KVCache::~KVCache() = default;
+
+void KVCache::Fork(int parent, int child, size_t size) {
+  CHECK_NE(parent, child);
+  Release(child);
+  size_t count = (size + kBlockSize - 1) / kBlockSize;
+  for (size_t layer = 0; layer < layers_; ++layer) {
+    const Table& from = Get(layer, parent);
+    CHECK_LE(count, from.blocks.size());
+    Table& to = Get(layer, child);
+    for (size_t i = 0; i < count; ++i) {
+      blocks_[from.blocks[i]].references++;
+      to.blocks.push_back(from.blocks[i]);
+      to.keys.push_back(from.keys[i]);
+      to.values.push_back(from.values[i]);
+    }
+  }
+}
+
+void KVCache::Release(int sequence) {
+  for (size_t layer = 0; layer < layers_; ++layer) {
+    Table& table = Get(layer, sequence);
+    for (size_t block : table.blocks) {
+      if (--blocks_[block].references == 0)
+        free_blocks_.push_back(block);
+    }
+    table.blocks.clear();
+    table.keys.clear();
+    table.values.clear();
+  }
+}
+
+std::pair<float*, float*> KVCache::Write(size_t layer,
+                                         int sequence,
+                                         size_t position) {
+  Table& table = Get(layer, sequence);
+  size_t index = position / kBlockSize;
+  CHECK_LT(index, max_blocks_);
+  // The positions are written in order, so only the block after the last one
+  // can be missing.
+  CHECK_LE(index, table.blocks.size());
+  if (index == table.blocks.size()) {
+    SetBlock(&table, index, Allocate());
+  } else if (blocks_[table.blocks[index]].references > 1) {
+    // Copy on write. The positions after |position| are copied too, which
+    // will be overwritten before being read.
+    size_t shared = table.blocks[index];
+    size_t copy = Allocate();
+    std::copy_n(blocks_[shared].data, floats_per_block_, blocks_[copy].data);
+    blocks_[shared].references--;
+    SetBlock(&table, index, copy);
+  }
+  float* keys = blocks_[table.blocks[index]].data +
+                position % kBlockSize * kv_dimension_;
+  return {keys, keys + kBlockSize * kv_dimension_};
+}
+
+KVCache::Table& KVCache::Get(size_t layer, int sequence) {
+  CHECK(sequence >= 0 && sequence < static_cast<int>(kMaxSequences));
+  return tables_[sequence * layers_ + layer];
+}
+
+const KVCache::Table& KVCache::Get(size_t layer, int sequence) const {
+  CHECK(sequence >= 0 && sequence < static_cast<int>(kMaxSequences));
+  return tables_[sequence * layers_ + layer];
+}
+
+void KVCache::Reserve(size_t begin, size_t end, const Batch& batch) {
+  for (size_t layer = begin; layer < end; ++layer) {
+    for (size_t b = 0; b < batch.count; ++b)
+      Write(layer, batch.sequences[b], batch.positions[b]);
+  }
+}
+
+size_t KVCache::Allocate() {
+  size_t block;
+  if (free_blocks_.empty()) {
+    block = blocks_.size();
+    size_t index = block % blocks_per_chunk_;
+    if (index == 0) {
+      chunks_.push_back(std::make_unique<LargeBuffer>(
+          sizeof(float) * floats_per_block_ * blocks_per_chunk_));
+    }
+    float* chunk = reinterpret_cast<float*>(chunks_.back()->data());
+    blocks_.push_back({chunk + index * floats_per_block_});
+  } else {
+    block = free_blocks_.back();
+    free_blocks_.pop_back();
+  }
+  blocks_[block].references = 1;
+  return block;
+}
+
+void KVCache::SetBlock(Table* table, size_t index, size_t block) {
+  const float* keys = blocks_[block].data;
+  const float* values = keys + kBlockSize * kv_dimension_;
+  if (index == table->blocks.size()) {
+    table->blocks.push_back(block);
+    table->keys.push_back(keys);
+    table->values.push_back(values);
+  } else {
+    table->blocks[index] = block;
+    table->keys[index] = keys;
+    table->values[index] = values;
+  }
+}
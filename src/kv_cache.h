@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "src/large_buffer.h"
+#include "src/model_config.h"
+#include "src/tensor.h"
+
+// How many sequences a model can keep at the same time: the sequence 0 is fed
+// by the Forward without sequences, and the others are forked from it for
+// parallel sampling and beam search, which may have the old and new beams
+// alive at the same time.
+constexpr size_t kMaxSequences = 2 * kMaxBatchSize + 1;
+
+// Where the tokens of a forward pass are: the i-th token is at positions[i]
+// of sequences[i].
+struct Batch {
+  size_t count = 0;
+  std::array<int, kMaxBatchSize> sequences;
+  std::array<size_t, kMaxBatchSize> positions;
+};
+
+// The computed keys and values of sequences.
+//
+// The cache of a layer is stored in blocks of kBlockSize positions, and each
+// sequence has a table of its blocks. A forked sequence shares the blocks of
+// its parent, and a shared block is only copied when one of the sequences
+// writes to it, so forking a sequence after a long prompt copies nothing but
+// the tables.
+//
+// A position is always written before being read, so rolling back a sequence
+// to a previous position (i.e. when the drafts are rejected in speculative
+// decoding) only needs to move the position.
+//
+// The blocks of a full sequence 0 are allocated when creating the cache, and
+// released blocks are reused, so generating a single sequence does not
+// allocate memory. The blocks are carved from chunks of LargeBuffer, so they
+// are backed by huge pages when possible.
+class KVCache {
+ public:
+  static constexpr size_t kBlockSize = 16;
+
+  KVCache(size_t layers, size_t kv_dimension, size_t sequence_size);
+  ~KVCache();
+
+  KVCache(const KVCache&) = delete;
+  KVCache& operator=(const KVCache&) = delete;
+
+  // Make |child| continue from the first |size| positions of |parent|.
+  void Fork(int parent, int child, size_t size);
+
+  // Drop the blocks of |sequence|.
+  void Release(int sequence);
+
+  // Return the keys and values at |position| of |sequence| for writing. The
+  // block is allocated if it does not exist, or copied if it is shared.
+  std::pair<float*, float*> Write(size_t layer, int sequence, size_t position);
+
+  // Allocate or copy the blocks that the tokens of |batch| will write to in
+  // the layers [begin, end). Write does not change the cache for them after
+  // that, so the layers can be written from different threads.
+  void Reserve(size_t begin, size_t end, const Batch& batch);
+
+  // The blocks of keys and values of |sequence|, each one has kBlockSize
+  // positions of kv_dimension floats.
+  std::span<const float* const> keys(size_t layer, int sequence) const {
+    return Get(layer, sequence).keys;
+  }
+  std::span<const float* const> values(size_t layer, int sequence) const {
+    return Get(layer, sequence).values;
+  }
+
+  size_t kv_dimension() const { return kv_dimension_; }
+
+ private:
+  struct Block {
+    // The keys followed by values.
+    float* data;
+    int references = 0;
+  };
+
+  // The blocks of a sequence in a layer.
+  struct Table {
+    std::vector<size_t> blocks;
+    std::vector<const float*> keys;
+    std::vector<const float*> values;
+  };
+
+  Table& Get(size_t layer, int sequence);
+  const Table& Get(size_t layer, int sequence) const;
+
+  // Return a block that is not used by any sequence.
+  size_t Allocate();
+  // Append or replace the |index|-th block of |table| with |block|.
+  void SetBlock(Table* table, size_t index, size_t block);
+
+  const size_t layers_;
+  const size_t kv_dimension_;
+  const size_t max_blocks_;
+
+  // Each chunk has |blocks_per_chunk_| blocks.
+  const size_t floats_per_block_;
+  const size_t blocks_per_chunk_;
+  std::vector<std::unique_ptr<LargeBuffer>> chunks_;
+
+  std::vector<Block> blocks_;
+  std::vector<size_t> free_blocks_;
+  // Indexed by [sequence][layer].
+  std::vector<Table> tables_;
+};
+
+// View of the keys or values of a sequence for AttendHead, indexed by
+// [position][kv_head].
+template<size_t H, size_t D>
+class KVCacheView {
+ public:
+  explicit KVCacheView(std::span<const float* const> blocks)
+      : blocks_(blocks) {}
+
+  frost::TensorViewF<H, D> operator[](size_t position) const {
+    const float* block = blocks_[position / KVCache::kBlockSize];
+    return frost::TensorViewF<H, D>(std::span<const float, H * D>(
+        block + position % KVCache::kBlockSize * H * D, H * D));
+  }
+
+ private:
+  std::span<const float* const> blocks_;
+};
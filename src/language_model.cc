@@ -0,0 +1,269 @@
+#include "src/language_model.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "src/runtime_transformer.h"
+#include "src/transformer.h"
+
+#include "models.h"  // generated header
+
+namespace {
+
+// The prefix of paths that refer to published weights.
+constexpr std::string_view kSharedMemoryPrefix = "shm:";
+// The prefix of paths whose weights are copied into a LargeBuffer.
+constexpr std::string_view kCopyPrefix = "copy:";
+
+#define MODEL_NAME(C) C::kName,
+constexpr const char* kModelNames[] = {FROST_FOR_EACH_MODEL(MODEL_NAME)};
+#undef MODEL_NAME
+
+// The name of model without directory and extension, i.e. "stories15M".
+std::string GetModelName(std::string_view path) {
+  size_t start = path.find_last_of("/\\:");
+  start = start == std::string_view::npos ? 0 : start + 1;
+  size_t end = path.find_last_of('.');
+  if (end == std::string_view::npos || end < start)
+    end = path.size();
+  return std::string(path.substr(start, end - start));
+}
+
+// Return the classifier weights of the compiled model.
+template<typename C>
+std::span<const float, C::kClassifierSize> GetClassifierWeights() {
+  if constexpr (C::kSharedClassifier) {
+    return std::span<const float, C::kClassifierSize>(C::kWeights.data(),
+                                                      C::kClassifierSize);
+  } else {
+    return C::kClassifierWeights;
+  }
+}
+
+// Publish the compiled weights in the llama2.c format.
+template<typename C>
+bool PublishCompiledWeights(const char* name) {
+  ModelShape shape = C::kShape;
+  if (!C::kSharedClassifier)
+    shape.tokens_size = -shape.tokens_size;
+  // The RoPE frequencies are not used when loading, so they are left zero.
+  std::vector<float> frequencies(C::kSequenceSize * C::kHeadDimension);
+  std::vector<std::span<const std::byte>> parts = {
+    std::as_bytes(std::span<const ModelShape>(&shape, 1)),
+    std::as_bytes(std::span<const float>(C::kWeights)),
+    std::as_bytes(std::span<const float>(frequencies)),
+  };
+  if constexpr (!C::kSharedClassifier)
+    parts.push_back(std::as_bytes(GetClassifierWeights<C>()));
+  return MappedFile::CreateSharedMemory(name, parts);
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<LanguageModel> LanguageModel::Create(std::string_view name) {
+  if (name.empty())
+    name = kModelNames[0];
+#define CREATE_MODEL(C)                                                       \
+  if (name == C::kName)                                                       \
+    return std::make_unique<Transformer<C>>(C::kWeights,                      \
+                                            GetClassifierWeights<C>());
+  FROST_FOR_EACH_MODEL(CREATE_MODEL)
+#undef CREATE_MODEL
+  return nullptr;
+}
+
+// static
+std::unique_ptr<LanguageModel> LanguageModel::Load(
+    const char* path,
+    std::string* error,
+    std::unique_ptr<Communicator> communicator) {
+  std::string_view path_view(path);
+  bool copy = path_view.starts_with(kCopyPrefix);
+  if (copy) {
+    path += kCopyPrefix.size();
+    path_view.remove_prefix(kCopyPrefix.size());
+  }
+  std::unique_ptr<MappedFile> file =
+      path_view.starts_with(kSharedMemoryPrefix) ?
+          MappedFile::OpenSharedMemory(path + kSharedMemoryPrefix.size()) :
+          MappedFile::Open(path);
+  if (!file) {
+    *error = std::string("Failed to open model: ") + path;
+    return nullptr;
+  }
+
+  std::span<const std::byte> data = file->data();
+  ModelShape shape;
+  if (data.size() < sizeof(shape)) {
+    *error = "Invalid model file.";
+    return nullptr;
+  }
+  memcpy(&shape, data.data(), sizeof(shape));
+  // A negative vocabulary size means the classifier has its own weights
+  // instead of sharing the token embedding table.
+  bool shared_classifier = shape.tokens_size > 0;
+  shape.tokens_size = std::abs(shape.tokens_size);
+  if (shape.embedding_size <= 0 || shape.hidden_dim <= 0 ||
+      shape.layers_size <= 0 || shape.heads_size <= 0 ||
+      shape.kv_heads_size <= 0 || shape.tokens_size <= 0 ||
+      shape.sequence_size <= 0 ||
+      shape.embedding_size % shape.heads_size != 0 ||
+      shape.heads_size % shape.kv_heads_size != 0 ||
+      (shape.embedding_size / shape.heads_size) % 2 != 0) {
+    *error = "Invalid model shape.";
+    return nullptr;
+  }
+
+  // The mapped file is backed by pages of the page cache, which are small
+  // unless the kernel supports huge pages for files.
+  std::unique_ptr<LargeBuffer> buffer;
+  if (copy) {
+    buffer = std::make_unique<LargeBuffer>(data.size());
+    memcpy(buffer->data(), data.data(), data.size());
+    data = {buffer->data(), data.size()};
+    file.reset();
+  }
+
+  // The weights are followed by the RoPE frequencies which are not used, and
+  // then the classifier when it is not shared.
+  const float* weights =
+      reinterpret_cast<const float*>(data.data() + sizeof(shape));
+  size_t weights_size = RuntimeTransformer::GetWeightsSize(shape);
+  size_t head_dimension = shape.embedding_size / shape.heads_size;
+  size_t classifier_offset =
+      weights_size + shape.sequence_size * head_dimension;
+  size_t size = shared_classifier ?
+      weights_size :
+      classifier_offset + shape.tokens_size * shape.embedding_size;
+  if ((data.size() - sizeof(shape)) / sizeof(float) < size) {
+    *error = "Model file is truncated.";
+    return nullptr;
+  }
+
+  const float* classifier =
+      shared_classifier ? weights : weights + classifier_offset;
+  std::unique_ptr<LanguageModel> model;
+  if (communicator) {
+    size_t ranks = communicator->ranks();
+    if (shape.heads_size % ranks != 0 || shape.kv_heads_size % ranks != 0 ||
+        shape.hidden_dim % ranks != 0) {
+      *error = "The heads, KV heads and hidden dimension of the model must be "
+               "divisible by the ranks.";
+      return nullptr;
+    }
+    model = std::make_unique<RuntimeTransformer>(
+        GetModelName(path), shape, weights, classifier,
+        std::move(communicator));
+  }
+#define CREATE_MODEL(C)                                                       \
+  if (!model && shape == C::kShape) {                                         \
+    model = std::make_unique<Transformer<C>>(                                 \
+        std::span<const float, C::kWeightsSize>(weights, C::kWeightsSize),    \
+        std::span<const float, C::kClassifierSize>(classifier,                \
+                                                   C::kClassifierSize));      \
+  }
+  FROST_FOR_EACH_MODEL(CREATE_MODEL)
+#undef CREATE_MODEL
+  if (!model) {
+    model = std::make_unique<RuntimeTransformer>(
+        GetModelName(path), shape, weights, classifier);
+  }
+  model->file_ = std::move(file);
+  model->buffer_ = std::move(buffer);
+  return model;
+}
+
+// static
+std::unique_ptr<LanguageModel> LanguageModel::CreateOrLoad(
+    std::string_view model, std::string* error) {
+  std::unique_ptr<LanguageModel> result = Create(model);
+  if (result)
+    return result;
+  // Not a compiled model, try loading it as checkpoint.
+  result = Load(std::string(model).c_str(), error);
+  if (!result) {
+    *error += "\nCompiled models:";
+    for (const char* name : Names())
+      *error += std::string(" ") + name;
+  }
+  return result;
+}
+
+// static
+bool LanguageModel::PublishWeights(std::string_view model,
+                                   const char* name,
+                                   std::string* error) {
+  if (model.empty())
+    model = kModelNames[0];
+  bool compiled = false;
+  bool published = false;
+#define PUBLISH_MODEL(C)                                                      \
+  if (!compiled && model == C::kName) {                                       \
+    compiled = true;                                                          \
+    published = PublishCompiledWeights<C>(name);                              \
+  }
+  FROST_FOR_EACH_MODEL(PUBLISH_MODEL)
+#undef PUBLISH_MODEL
+  if (!compiled) {
+    // Copy the checkpoint as is.
+    std::unique_ptr<MappedFile> file =
+        MappedFile::Open(std::string(model).c_str());
+    if (!file) {
+      *error = "Failed to open model: " + std::string(model);
+      return false;
+    }
+    std::span<const std::byte> data = file->data();
+    published = MappedFile::CreateSharedMemory(name, {&data, 1});
+  }
+  if (!published) {
+    *error = std::string("Failed to create shared memory: ") + name;
+    return false;
+  }
+  return true;
+}
+
+// static
+bool LanguageModel::UnpublishWeights(const char* name) {
+  return MappedFile::RemoveSharedMemory(name);
+}
+
+// static
+std::span<const char* const> LanguageModel::Names() {
+  return kModelNames;
+}
+
+LanguageModel::~LanguageModel() = default;
+
+std::span<float> LanguageModel::Forward(std::span<const int> tokens,
+                                        size_t position) {
+  CHECK_LE(tokens.size(), kMaxBatchSize);
+  std::array<int, kMaxBatchSize> sequences = {};
+  std::array<size_t, kMaxBatchSize> positions;
+  for (size_t i = 0; i < tokens.size(); ++i)
+    positions[i] = position + i;
+  return Forward(tokens,
+                 std::span<const int>(sequences.data(), tokens.size()),
+                 std::span<const size_t>(positions.data(), tokens.size()));
+}
+
+void LanguageModel::SetAllowedTokens(std::span<const int> tokens) {
+  CHECK(std::is_sorted(tokens.begin(), tokens.end()));
+  CHECK(tokens.empty() ||
+        (tokens.front() >= 0 && tokens.back() < shape().tokens_size));
+  allowed_tokens_.assign(tokens.begin(), tokens.end());
+}
+
+bool LanguageModel::EnableLayerStreaming() {
+  if (!file_ || !file_->mapped())
+    return false;
+  if (!layer_streamer_) {
+    // The weights follow the shape in the checkpoint.
+    const float* weights = reinterpret_cast<const float*>(
+        file_->data().data() + sizeof(ModelShape));
+    layer_streamer_ = std::make_unique<LayerStreamer>(file_.get(), weights,
+                                                      shape());
+  }
+  return true;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/communicator.h"
+#include "src/kv_cache.h"
+#include "src/large_buffer.h"
+#include "src/layer_streamer.h"
+#include "src/mapped_file.h"
+#include "src/model_config.h"
+
+// The interface of models, so code that is not specialized for the shapes of
+// a model can run any of them.
+class LanguageModel {
+ public:
+  // Create the compiled model with |name|, or the first compiled model when
+  // |name| is empty. Return nullptr if there is no such model.
+  static std::unique_ptr<LanguageModel> Create(std::string_view name);
+
+  // Load a llama2.c checkpoint from |path|. When the shape matches a compiled
+  // model the specialized Transformer runs on the loaded weights, otherwise a
+  // RuntimeTransformer. A |path| of "shm:<name>" maps the weights published
+  // with PublishWeights, and a "copy:" prefix copies the weights into a
+  // LargeBuffer instead of using the mapping, so they are backed by huge
+  // pages. With a |communicator| the model is the shard of its rank in tensor
+  // parallel inference, which is always a RuntimeTransformer.
+  // Return nullptr and write the reason to |error| on failure.
+  static std::unique_ptr<LanguageModel> Load(
+      const char* path,
+      std::string* error,
+      std::unique_ptr<Communicator> communicator = nullptr);
+
+  // Create the compiled model with |model| name, or load the llama2.c
+  // checkpoint when |model| is a path. Return nullptr and write the reason to
+  // |error| on failure.
+  static std::unique_ptr<LanguageModel> CreateOrLoad(std::string_view model,
+                                                     std::string* error);
+
+  // Copy the weights of the compiled |model|, or of the llama2.c checkpoint
+  // when |model| is a path, into the shared memory object |name| in the
+  // checkpoint format. Processes loading "shm:<name>" then share one copy of
+  // the weights in memory, which stays until UnpublishWeights is called.
+  // Return false and write the reason to |error| on failure.
+  static bool PublishWeights(std::string_view model,
+                             const char* name,
+                             std::string* error);
+
+  // Remove the weights published as |name|. The processes that have loaded
+  // them keep running. Return false if there is no such object.
+  static bool UnpublishWeights(const char* name);
+
+  // Names of the compiled models.
+  static std::span<const char* const> Names();
+
+  virtual ~LanguageModel();
+
+  virtual const char* name() const = 0;
+  virtual const ModelShape& shape() const = 0;
+
+  // Feed |tokens| in one pass, the i-th token is at |positions[i]| of
+  // |sequences[i]|, and return the logits of the token following each of
+  // them, one row of tokens_size for each token, which are valid until next
+  // call. At most kMaxBatchSize tokens can be fed at once.
+  //
+  // The weights are read once for all tokens, so feeding K tokens costs about
+  // the same with feeding one token when the pass is bound by memory.
+  virtual std::span<float> Forward(std::span<const int> tokens,
+                                   std::span<const int> sequences,
+                                   std::span<const size_t> positions) = 0;
+
+  // Same with Forward but return the hidden states after the final
+  // normalization instead of logits, one row of embedding_size for each token.
+  // The classifier, which is the largest matrix of small models, is skipped.
+  virtual std::span<float> ForwardHidden(
+      std::span<const int> tokens,
+      std::span<const int> sequences,
+      std::span<const size_t> positions) = 0;
+
+  // Feed |tokens| of sequence 0 at the positions starting from |position|.
+  std::span<float> Forward(std::span<const int> tokens, size_t position);
+
+  // Feed |token| of sequence 0 at |position|.
+  std::span<float> Forward(int token, size_t position) {
+    return Forward(std::span<const int>(&token, 1), position);
+  }
+
+  // Make |child| sequence continue from the first |size| tokens of |parent|,
+  // sharing the KV cache of them.
+  virtual void Fork(int parent, int child, size_t size) = 0;
+
+  // Drop the KV cache of |sequence|.
+  virtual void Release(int sequence) = 0;
+
+  // Only compute the logits of |tokens|, which must be sorted, and set the
+  // logits of other tokens to kMaskedLogit. The classifier skips the rows of
+  // other tokens, which saves most of its cost for constrained generation. An
+  // empty |tokens| allows all tokens.
+  void SetAllowedTokens(std::span<const int> tokens);
+
+  // Stream the weights of decoders from the checkpoint instead of keeping them
+  // in memory, for models larger than memory, see src/layer_streamer.h.
+  // Return false if the model is not loaded from a memory mapped checkpoint.
+  bool EnableLayerStreaming();
+
+  // Run the decoders in |stages| pipeline stages, each one on its own thread
+  // running a contiguous group of decoders, see src/pipeline.h. The tokens of
+  // a pass are split into a micro-batch for each stage, which the stages run
+  // at the same time. Passes of a single token, and streamed layers, still
+  // run on the calling thread. 1 stage disables the pipeline. The thread of
+  // stage i is pinned to |cpus[i]| when it exists, and allocates the buffers
+  // of micro-batch i after pinned, so their pages are on the NUMA node of the
+  // CPU.
+  virtual void EnablePipeline(size_t stages, std::span<const int> cpus) = 0;
+
+  // Self-speculative decoding drafts tokens with the first decoders of the
+  // model itself, which exit early before the rest decoders.
+  //
+  // Feed |token| of sequence 0 at |position| into the first |layers| decoders
+  // only. The tokens fed until next FinishEarlyExit must be at consecutive
+  // positions, and at most kMaxBatchSize of them.
+  virtual void FeedEarlyExit(int token, size_t position, size_t layers) = 0;
+
+  // Return the logits of next token computed from the output of the first
+  // decoders for the last token passed to FeedEarlyExit.
+  virtual std::span<float> EarlyExitLogits() = 0;
+
+  // Feed the tokens passed to FeedEarlyExit into the rest decoders in one
+  // pass, and return the logits like Forward. The first decoders are not run
+  // again, as their outputs and KV cache are same with a full pass.
+  virtual std::span<float> FinishEarlyExit() = 0;
+
+ protected:
+  const std::vector<int>& allowed_tokens() const { return allowed_tokens_; }
+  bool layer_streaming() const { return layer_streamer_ != nullptr; }
+
+  // Called by the models around running the decoder |layer| for all tokens of
+  // a pass.
+  void BeginLayer(size_t layer) {
+    if (layer_streamer_)
+      layer_streamer_->BeginLayer(layer);
+  }
+  void EndLayer(size_t layer) {
+    if (layer_streamer_)
+      layer_streamer_->EndLayer(layer);
+  }
+
+ private:
+  std::vector<int> allowed_tokens_;
+
+  // The checkpoint the weights are loaded from, or the copy of its data.
+  std::unique_ptr<MappedFile> file_;
+  std::unique_ptr<LargeBuffer> buffer_;
+  std::unique_ptr<LayerStreamer> layer_streamer_;
+};
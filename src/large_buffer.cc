@@ -0,0 +1,84 @@
+#include "src/large_buffer.h"
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::atomic<bool> numa_interleave = false;
+
+#if defined(__linux__)
+// Interleave the pages of the |size| bytes at |data| over the NUMA nodes the
+// process can use, which must be called before the pages are touched. Does
+// nothing on hosts with one node. The syscalls are used directly so libnuma
+// is not required.
+void InterleavePages(void* data, size_t size) {
+  unsigned long nodes[16] = {};
+  constexpr unsigned long kMaxNodes = sizeof(nodes) * 8;
+  if (syscall(SYS_get_mempolicy, nullptr, nodes, kMaxNodes, nullptr,
+              MPOL_F_MEMS_ALLOWED) != 0) {
+    return;
+  }
+  int count = 0;
+  for (unsigned long mask : nodes)
+    count += std::popcount(mask);
+  if (count > 1)
+    syscall(SYS_mbind, data, size, MPOL_INTERLEAVE, nodes, kMaxNodes, 0);
+}
+#endif
+
+}  // namespace
+
+// static
+void LargeBuffer::SetNumaInterleave(bool interleave) {
+  numa_interleave = interleave;
+}
+
+LargeBuffer::LargeBuffer(size_t size) : size_(size) {
+#if defined(__linux__)
+  size_t rounded = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  // Explicit huge pages, which only work when the system has reserved them.
+  void* mapping = mmap(nullptr, rounded, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (mapping != MAP_FAILED) {
+    mapping_ = mapping;
+    mapping_size_ = rounded;
+    data_ = static_cast<std::byte*>(mapping);
+  } else {
+    // Transparent huge pages, the mapping is over-allocated so the data can
+    // be aligned to a huge page.
+    mapping = mmap(nullptr, rounded + kHugePageSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping != MAP_FAILED) {
+      mapping_ = mapping;
+      mapping_size_ = rounded + kHugePageSize;
+      uintptr_t address = reinterpret_cast<uintptr_t>(mapping);
+      address = (address + kHugePageSize - 1) & ~(kHugePageSize - 1);
+      data_ = reinterpret_cast<std::byte*>(address);
+      madvise(data_, rounded, MADV_HUGEPAGE);
+    }
+  }
+  if (data_) {
+    if (numa_interleave)
+      InterleavePages(data_, rounded);
+    return;
+  }
+#endif
+  heap_.reset(new std::byte[size]());
+  data_ = heap_.get();
+}
+
+LargeBuffer::~LargeBuffer() {
+#if defined(__linux__)
+  if (mapping_)
+    munmap(mapping_, mapping_size_);
+#endif
+}
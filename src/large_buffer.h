@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+// Zero-initialized memory for large arrays that are read by every token, like
+// the KV cache and the weights copied from checkpoints.
+//
+// On Linux the memory is backed by huge pages when possible, which reduces the
+// TLB misses when streaming through the arrays: explicit huge pages are used
+// when the system has reserved them, otherwise transparent huge pages are
+// requested with madvise. Other platforms get normal heap memory.
+class LargeBuffer {
+ public:
+  // The size of a huge page on x86-64 and most arm64 systems.
+  static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+  // Interleave the pages of the buffers created after this call over the
+  // NUMA nodes on Linux. Otherwise the pages are on the node of the thread
+  // first touching them, and the threads on other nodes, like pipeline
+  // stages, read them through the interconnect.
+  static void SetNumaInterleave(bool interleave);
+
+  explicit LargeBuffer(size_t size);
+  ~LargeBuffer();
+
+  LargeBuffer(const LargeBuffer&) = delete;
+  LargeBuffer& operator=(const LargeBuffer&) = delete;
+
+  std::byte* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  std::byte* data_ = nullptr;
+  size_t size_;
+  // The mapped region, which may be larger than |size_| for alignment.
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  // Used when the memory can not be mapped.
+  std::unique_ptr<std::byte[]> heap_;
+};
@@ -0,0 +1,53 @@
+#include "src/layer_streamer.h"
+
+LayerStreamer::LayerStreamer(const MappedFile* file,
+                             const float* weights,
+                             const ModelShape& shape)
+    : file_(file), layers_(shape.layers_size) {
+  size_t dim = shape.embedding_size;
+  size_t hidden_dim = shape.hidden_dim;
+  size_t kv_dimension = dim / shape.heads_size * shape.kv_heads_size;
+  size_t layers = shape.layers_size;
+  // The same order with the weights in RuntimeTransformer's constructor, each
+  // kind of weights is stored for all layers one after another.
+  const size_t sizes[] = {
+    dim,                      // attention_norm
+    dim * dim,                // wq
+    kv_dimension * dim,       // wk
+    kv_dimension * dim,       // wv
+    dim * dim,                // wo
+    dim,                      // feed_forward_norm
+    hidden_dim * dim,         // w1
+    dim * hidden_dim,         // w2
+    hidden_dim * dim,         // w3
+  };
+  static_assert(std::size(sizes) == std::tuple_size_v<Ranges>);
+  const float* next = weights + shape.tokens_size * dim;
+  for (size_t kind = 0; kind < std::size(sizes); ++kind) {
+    for (size_t i = 0; i < layers; ++i) {
+      layers_[i][kind] = std::as_bytes(std::span<const float>(
+          next + i * sizes[kind], sizes[kind]));
+    }
+    next += layers * sizes[kind];
+  }
+}
+
+LayerStreamer::~LayerStreamer() = default;
+
+void LayerStreamer::BeginLayer(size_t layer) {
+  if (prefetched_ != layer) {
+    for (std::span<const std::byte> range : layers_[layer])
+      file_->Prefetch(range);
+  }
+  prefetched_ = (layer + 1) % layers_.size();
+  for (std::span<const std::byte> range : layers_[prefetched_])
+    file_->Prefetch(range);
+}
+
+void LayerStreamer::EndLayer(size_t layer) {
+  // A model with a single layer keeps it.
+  if (layer == prefetched_)
+    return;
+  for (std::span<const std::byte> range : layers_[layer])
+    file_->Evict(range);
+}
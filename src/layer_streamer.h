@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "src/mapped_file.h"
+#include "src/model_config.h"
+
+// Streams the weights of decoders from a memory mapped checkpoint, so a model
+// larger than memory only needs the weights of the running and next decoders
+// to be resident.
+//
+// The models call BeginLayer and EndLayer around running each decoder for all
+// the tokens of a pass. The pages of next decoder are read ahead by the kernel
+// while the current one computes, and the pages of a finished decoder are
+// dropped, which will be read from the file again in next pass. The token
+// embedding table and the classifier are not managed, as only a few rows of
+// the former are read and the latter is needed by every pass.
+class LayerStreamer {
+ public:
+  // The |weights| are in the llama2.c layout (see src/model_weights.h) inside
+  // the |file|, which must outlive the streamer.
+  LayerStreamer(const MappedFile* file,
+                const float* weights,
+                const ModelShape& shape);
+  ~LayerStreamer();
+
+  LayerStreamer(const LayerStreamer&) = delete;
+  LayerStreamer& operator=(const LayerStreamer&) = delete;
+
+  // Prefetch the weights of |layer| if they were not prefetched, and the ones
+  // of the layer after it, which is the first layer for the last one.
+  void BeginLayer(size_t layer);
+
+  // Drop the weights of |layer| from memory.
+  void EndLayer(size_t layer);
+
+ private:
+  // The weights of a decoder: norms, wq, wk, wv, wo and w1, w2, w3.
+  using Ranges = std::array<std::span<const std::byte>, 9>;
+
+  const MappedFile* file_;
+  std::vector<Ranges> layers_;
+  // The layer prefetched by last BeginLayer.
+  size_t prefetched_ = static_cast<size_t>(-1);
+};
@@ -0,0 +1,196 @@
+#include "src/mapped_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#if !defined(_WIN32)
+// The names of shared memory objects start with a slash.
+std::string GetSharedMemoryName(const char* name) {
+  return name[0] == '/' ? name : std::string("/") + name;
+}
+#endif
+
+}  // namespace
+
+// static
+std::unique_ptr<MappedFile> MappedFile::Open(const char* path) {
+  std::unique_ptr<MappedFile> file(new MappedFile);
+#if !defined(_WIN32)
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+  file->Map(fd);
+  close(fd);
+  if (file->mapped_)
+    return file;
+#endif
+  // Fallback to reading the whole file.
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return nullptr;
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  if (size < 0) {
+    fclose(f);
+    return nullptr;
+  }
+  file->buffer_.resize(size);
+  size_t read = fread(file->buffer_.data(), 1, size, f);
+  fclose(f);
+  if (read != static_cast<size_t>(size))
+    return nullptr;
+  file->data_ = file->buffer_.data();
+  file->size_ = file->buffer_.size();
+  return file;
+}
+
+// static
+std::unique_ptr<MappedFile> MappedFile::OpenSharedMemory(const char* name) {
+#if !defined(_WIN32)
+  int fd = shm_open(GetSharedMemoryName(name).c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return nullptr;
+  std::unique_ptr<MappedFile> file(new MappedFile);
+  file->Map(fd);
+  close(fd);
+  if (file->mapped_)
+    return file;
+#endif
+  return nullptr;
+}
+
+// static
+bool MappedFile::CreateSharedMemory(
+    const char* name,
+    std::span<const std::span<const std::byte>> parts) {
+#if !defined(_WIN32)
+  size_t size = 0;
+  for (std::span<const std::byte> part : parts)
+    size += part.size();
+  if (size == 0)
+    return false;
+  std::string shm_name = GetSharedMemoryName(name);
+#if defined(__linux__)
+  // Write a temporary object and rename it to |name| when complete, so the
+  // processes opening |name| never see partial data. The shared memory
+  // objects are files in /dev/shm on Linux.
+  std::string temp_name = shm_name + "." + std::to_string(getpid());
+#else
+  // Create a new object instead of writing into the existing one, which may
+  // be in use by other processes.
+  std::string temp_name = shm_name;
+#endif
+  shm_unlink(temp_name.c_str());
+  int fd = shm_open(temp_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return false;
+  bool allocated = ftruncate(fd, size) == 0;
+#if defined(__linux__)
+  // Allocate the pages now, otherwise writing them raises SIGBUS when
+  // /dev/shm is smaller than the data.
+  allocated = allocated && posix_fallocate(fd, 0, size) == 0;
+#endif
+  void* data = MAP_FAILED;
+  if (allocated)
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    shm_unlink(temp_name.c_str());
+    return false;
+  }
+  std::byte* next = static_cast<std::byte*>(data);
+  for (std::span<const std::byte> part : parts) {
+    memcpy(next, part.data(), part.size());
+    next += part.size();
+  }
+  munmap(data, size);
+#if defined(__linux__)
+  if (rename(("/dev/shm" + temp_name).c_str(),
+             ("/dev/shm" + shm_name).c_str()) != 0) {
+    shm_unlink(temp_name.c_str());
+    return false;
+  }
+#endif
+  return true;
+#else
+  return false;
+#endif
+}
+
+// static
+bool MappedFile::RemoveSharedMemory(const char* name) {
+#if !defined(_WIN32)
+  return shm_unlink(GetSharedMemoryName(name).c_str()) == 0;
+#else
+  return false;
+#endif
+}
+
+void MappedFile::Prefetch(std::span<const std::byte> range) const {
+#if !defined(_WIN32)
+  if (!mapped_ || range.empty())
+    return;
+  // The range is extended to whole pages.
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t address = reinterpret_cast<uintptr_t>(range.data());
+  uintptr_t begin = address & ~(page_size - 1);
+  uintptr_t end = address + range.size();
+  madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+#endif
+}
+
+void MappedFile::Evict(std::span<const std::byte> range) const {
+#if !defined(_WIN32)
+  if (!mapped_)
+    return;
+  // Only the whole pages inside the range are dropped, so the data around the
+  // range stays in memory.
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t address = reinterpret_cast<uintptr_t>(range.data());
+  uintptr_t begin = (address + page_size - 1) & ~(page_size - 1);
+  uintptr_t end = (address + range.size()) & ~(page_size - 1);
+  if (begin < end)
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+#endif
+}
+
+bool MappedFile::Map(int fd) {
+#if !defined(_WIN32)
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    return false;
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    return false;
+#if defined(MADV_HUGEPAGE)
+  // The weights are read by every token, let the kernel back them with huge
+  // pages when it supports them for read-only files.
+  madvise(data, st.st_size, MADV_HUGEPAGE);
+#endif
+  data_ = static_cast<const std::byte*>(data);
+  size_ = st.st_size;
+  mapped_ = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if !defined(_WIN32)
+  if (mapped_)
+    munmap(const_cast<std::byte*>(data_), size_);
+#endif
+}
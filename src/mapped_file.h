@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Read-only view of a whole file.
+//
+// The file is memory mapped when possible, otherwise it is read into memory.
+class MappedFile {
+ public:
+  // Return nullptr on failure.
+  static std::unique_ptr<MappedFile> Open(const char* path);
+
+  // Map the POSIX shared memory object |name|, whose pages are shared by all
+  // the processes mapping it. Return nullptr on failure, or when shared memory
+  // is not supported.
+  static std::unique_ptr<MappedFile> OpenSharedMemory(const char* name);
+
+  // Create the shared memory object |name| with |parts| written one after
+  // another. An existing object with the same name is replaced, and the
+  // processes that have mapped it keep the old data. On Linux the object is
+  // replaced only after it is completely written. Return false on failure.
+  static bool CreateSharedMemory(
+      const char* name,
+      std::span<const std::span<const std::byte>> parts);
+
+  // Remove the shared memory object |name|. The memory is freed after the
+  // processes that have mapped it exit. Return false on failure.
+  static bool RemoveSharedMemory(const char* name);
+
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Hint that |range| of the data will be read soon, so its pages are read
+  // from the file in background. Does nothing when the file is not mapped.
+  void Prefetch(std::span<const std::byte> range) const;
+
+  // Hint that |range| of the data is not needed for now, so its pages can be
+  // dropped from memory, and will be read from the file again when accessed.
+  // Does nothing when the file is not mapped.
+  void Evict(std::span<const std::byte> range) const;
+
+  std::span<const std::byte> data() const { return {data_, size_}; }
+  size_t size() const { return size_; }
+  bool mapped() const { return mapped_; }
+
+ private:
+  MappedFile() = default;
+
+  // Map the whole file of |fd|. Return false on failure.
+  bool Map(int fd);
+
+  const std::byte* data_ = nullptr;
+  size_t size_ = 0;
+  bool mapped_ = false;
+  // Used when the file can not be mapped.
+  std::vector<std::byte> buffer_;
+};
@@ -2,38 +2,40 @@
 
 #include <algorithm>
 #include <cmath>
+#include <complex>
+#include <span>
 
-#include "model_config.h"  // generated header
+#include "src/model_config.h"
 #include "src/tensor.h"
 
+using frost::MutableTensorViewF;
 using frost::Tensor;
 using frost::TensorF;
 using frost::TensorViewF;
 
-// In multi-head attention, each head is only responsible for transforming a
-// part of the embedding, and kHeadDimension is the size of the part.
-constexpr
-size_t kHeadDimension = kEmbeddingSize / kHeadsSize;
-
 // Re-scale the scalars of |x| with Root Mean Square Normalization, so the scalars
 // won't be too large or too small.
-template<size_t N>
-TensorF<N> RMSNormalize(TensorViewF<N> x, TensorViewF<N> weights) {
+template<template<typename, size_t> typename S1,
+         template<typename, size_t> typename S2,
+         typename T1, typename T2, size_t N>
+void RMSNormalize(const frost::TensorBase<S1, T1, N>& x,
+                  TensorViewF<N> weights,
+                  frost::TensorBase<S2, T2, N>* out) {
+  PROFILE_OP(kRMSNormalize, sizeof(float) * N * 3);
   float sum_of_squres = 0;
   for (size_t i = 0; i < N; ++i)
     sum_of_squres += x[i] * x[i];
   // The constant is used by LLaMa2 to prevent running sqrt(0).
   float rms = std::sqrt(sum_of_squres / N + 1e-5f);
-  TensorF<N> result;
   for (size_t i = 0; i < N; ++i)
-    result[i] = weights[i] * x[i] / rms;
-  return result;
+    (*out)[i] = weights[i] * x[i] / rms;
 }
 
 // Convert a vector of scalars to a probability distribution.
 template<typename Iter>
 void Softmax(Iter first, Iter last) {
   using T = std::remove_reference_t<decltype(*first)>;
+  PROFILE_OP(kSoftmax, sizeof(T) * (last - first) * 2);
   T max_val = *std::max_element(first, last);
   T sum = T();
   for (Iter it = first; it != last; ++it) {
@@ -44,3 +46,55 @@ void Softmax(Iter first, Iter last) {
     *it /= sum;
   }
 }
+
+// Implement RoPE (Rotary Position Embedding) with complex numbers, which
+// essentially transforms the embeddings into points on complex-plane, then use
+// another complex number with magnitue of 1 to rotate it, and convert the
+// points back to embeddings.
+template<template<typename, size_t> typename S, typename T, size_t N>
+void ApplyRotaryEmbeddings(size_t position, frost::TensorBase<S, T, N>* x) {
+  static_assert(N % 2 == 0);
+  PROFILE_OP(kRotaryEmbeddings, sizeof(T) * N * 2);
+  for (size_t i = 0; i < N; i += 2) {
+    std::complex<T> sibling((*x)[i], (*x)[i + 1]);
+    float theta = std::pow(10000.f, -1.f * i / N);
+    std::complex<T> frequency = std::polar(1.f, position * theta);
+    std::complex<T> rotated = sibling * frequency;
+    (*x)[i] = rotated.real();
+    (*x)[i + 1] = rotated.imag();
+  }
+}
+
+// Compute the attention of a single head: score |query| against the keys of
+// all positions up to |position|, and write the sum of values weighted by the
+// scores to |output|. The |keys| and |values| are caches indexed by
+// [position][kv_head], and |scores| is a buffer with at least |position| + 1
+// elements.
+template<typename Keys, typename Values, size_t D>
+void AttendHead(TensorViewF<D> query,
+                const Keys& keys,
+                const Values& values,
+                size_t kv_head,
+                size_t position,
+                std::span<float> scores,
+                MutableTensorViewF<D> output) {
+  {
+    PROFILE_OP(kAttentionScores, sizeof(float) * (position + 1) * (D + 1));
+    for (size_t past = 0; past <= position; ++past) {
+      TensorViewF<D> key = keys[past][kv_head];
+      scores[past] = DotProduct(query, key) / std::sqrt(D);
+    }
+  }
+  // Make the scores sum up to 1.
+  Softmax(scores.begin(), scores.begin() + position + 1);
+
+  PROFILE_OP(kAttentionValues, sizeof(float) * (position + 1) * (D + 1));
+  std::fill(output.begin(), output.end(), 0);
+  for (size_t past = 0; past <= position; ++past) {
+    TensorViewF<D> value = values[past][kv_head];
+    float score = scores[past];
+    for (size_t i = 0; i < D; ++i) {
+      output[i] += value[i] * score;
+    }
+  }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The shape of a model, which has the same layout with the header of llama2.c
+// checkpoints.
+struct ModelShape {
+  int32_t embedding_size;
+  int32_t hidden_dim;
+  int32_t layers_size;
+  int32_t heads_size;
+  int32_t kv_heads_size;
+  int32_t tokens_size;
+  int32_t sequence_size;
+
+  bool operator==(const ModelShape& other) const = default;
+};
+
+// The max number of tokens that can be fed into a model in one pass.
+constexpr size_t kMaxBatchSize = 8;
+
+// The logit of the tokens not allowed by LanguageModel::SetAllowedTokens, whose
+// probability is 0 after softmax. Infinity is not used as it is assumed to not
+// exist with -Ofast.
+constexpr float kMaskedLogit = -1e30f;
+
+// The shape of a model known at compile time.
+//
+// The layers are templated on the config so the kernels are specialized for
+// the shapes of each model, and the configs of the compiled models are
+// generated in "models.h" by export_llama2_c_weights.
+template<int Embedding, int Hidden, int Layers, int Heads, int KVHeads,
+         int Tokens, int Sequence>
+struct ModelConfig {
+  static constexpr size_t kEmbeddingSize = Embedding;
+  static constexpr size_t kHiddenDim = Hidden;
+  static constexpr size_t kLayersSize = Layers;
+  static constexpr size_t kHeadsSize = Heads;
+  static constexpr size_t kKVHeadsSize = KVHeads;
+  static constexpr size_t kTokensSize = Tokens;
+  static constexpr size_t kSequenceSize = Sequence;
+
+  // In multi-head attention, each head is only responsible for transforming a
+  // part of the embedding, and kHeadDimension is the size of the part.
+  static constexpr size_t kHeadDimension = kEmbeddingSize / kHeadsSize;
+  static_assert(kHeadDimension * kHeadsSize == kEmbeddingSize);
+
+  // In grouped attention, the keys and values have less heads than queries.
+  static constexpr size_t kKVDimension = kKVHeadsSize * kHeadDimension;
+  static_assert(kHeadsSize % kKVHeadsSize == 0);
+
+  // How many floats the weights have, see src/model_weights.h for the layout.
+  static constexpr size_t kLayerWeightsSize =
+      2 * kEmbeddingSize +
+      kEmbeddingSize * kEmbeddingSize * 2 +
+      kKVDimension * kEmbeddingSize * 2 +
+      kHiddenDim * kEmbeddingSize * 3;
+  static constexpr size_t kWeightsSize =
+      kTokensSize * kEmbeddingSize +
+      kLayersSize * kLayerWeightsSize +
+      kEmbeddingSize;
+
+  // The classifier computing logits shares the weights of token embedding
+  // table by default, otherwise the model config has kClassifierWeights.
+  static constexpr bool kSharedClassifier = true;
+  static constexpr size_t kClassifierSize = kTokensSize * kEmbeddingSize;
+
+  static constexpr ModelShape kShape = {
+    Embedding, Hidden, Layers, Heads, KVHeads, Tokens, Sequence,
+  };
+};
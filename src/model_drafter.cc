@@ -0,0 +1,56 @@
+#include "src/model_drafter.h"
+
+#include <algorithm>
+
+#include "src/model_common.h"
+#include "src/trace.h"
+
+ModelDrafter::ModelDrafter(std::unique_ptr<LanguageModel> model)
+    : model_(std::move(model)) {
+  fed_.reserve(model_->shape().sequence_size);
+}
+
+ModelDrafter::~ModelDrafter() = default;
+
+void ModelDrafter::Propose(std::span<const int> sequence,
+                           size_t max_tokens,
+                           float top_p,
+                           Sampler* sampler,
+                           std::vector<int>* tokens,
+                           std::vector<float>* probabilities) {
+  TRACE_EVENT("ModelDrafter::Propose");
+  tokens->clear();
+  probabilities->clear();
+  size_t sequence_size = model_->shape().sequence_size;
+  if (max_tokens == 0 || sequence.empty() || sequence.size() >= sequence_size)
+    return;
+  max_tokens = std::min(max_tokens, sequence_size - sequence.size());
+
+  // Skip the prefix that has been fed, the last token is always fed again to
+  // get the logits following it. Like the target model, the KV cache after
+  // the prefix is overwritten so there is no need to clear it.
+  size_t common = std::mismatch(fed_.begin(), fed_.end(),
+                                sequence.begin(), sequence.end()).first -
+                  fed_.begin();
+  common = std::min(common, sequence.size() - 1);
+  std::span<float> logits;
+  for (size_t i = common; i < sequence.size(); i += kMaxBatchSize) {
+    size_t count = std::min(kMaxBatchSize, sequence.size() - i);
+    logits = model_->Forward(sequence.subspan(i, count), i);
+  }
+  fed_.assign(sequence.begin(), sequence.end());
+
+  size_t vocab = model_->shape().tokens_size;
+  logits = logits.last(vocab);
+  while (true) {
+    Softmax(logits.begin(), logits.end());
+    sampler->TruncateTopP(logits, top_p);
+    probabilities->insert(probabilities->end(), logits.begin(), logits.end());
+    int token = sampler->Sample(logits);
+    tokens->push_back(token);
+    if (tokens->size() == max_tokens)
+      break;
+    logits = model_->Forward(token, fed_.size());
+    fed_.push_back(token);
+  }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <memory>
+
+#include "src/drafter.h"
+#include "src/language_model.h"
+
+// Proposes tokens by sampling from a small draft model, which must have the
+// same vocabulary with the target model.
+class ModelDrafter : public Drafter {
+ public:
+  explicit ModelDrafter(std::unique_ptr<LanguageModel> model);
+  ~ModelDrafter() override;
+
+  const LanguageModel& model() const { return *model_; }
+
+  // Drafter:
+  void Propose(std::span<const int> sequence,
+               size_t max_tokens,
+               float top_p,
+               Sampler* sampler,
+               std::vector<int>* tokens,
+               std::vector<float>* probabilities) override;
+
+ private:
+  std::unique_ptr<LanguageModel> model_;
+
+  // The tokens fed into the draft model, the KV cache of the prefix that is
+  // shared with next sequence is reused.
+  std::vector<int> fed_;
+};
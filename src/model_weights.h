@@ -0,0 +1,69 @@
+#pragma once
+
+#include <span>
+
+#include "src/model_common.h"
+
+// Views of the weights of a model.
+//
+// The weights are stored in the same layout with llama2.c checkpoints, where
+// each kind of weights is stored for all layers one after another, in the
+// order of the members below. The views do not own the data, so the weights
+// can either be compiled into the binary or come from other memory.
+//
+// The classifier is stored separately, which is the token embedding table when
+// the weights are shared.
+template<typename C>
+struct ModelWeights {
+  ModelWeights(std::span<const float, C::kWeightsSize> data,
+               std::span<const float, C::kClassifierSize> classifier_data)
+      : token_embedding_table(data, kTokenEmbeddingTableOffset),
+        attention_norm(data, kAttentionNormOffset),
+        wq(data, kQueryOffset),
+        wk(data, kKeyOffset),
+        wv(data, kValueOffset),
+        wo(data, kOutputOffset),
+        feed_forward_norm(data, kFeedForwardNormOffset),
+        w1(data, kFeedForward1Offset),
+        w2(data, kFeedForward2Offset),
+        w3(data, kFeedForward3Offset),
+        output_norm(data, kOutputNormOffset),
+        classifier(classifier_data) {}
+
+  TensorViewF<C::kTokensSize, C::kEmbeddingSize> token_embedding_table;
+  TensorViewF<C::kLayersSize, C::kEmbeddingSize> attention_norm;
+  TensorViewF<C::kLayersSize, C::kEmbeddingSize, C::kEmbeddingSize> wq;
+  TensorViewF<C::kLayersSize, C::kKVDimension, C::kEmbeddingSize> wk;
+  TensorViewF<C::kLayersSize, C::kKVDimension, C::kEmbeddingSize> wv;
+  TensorViewF<C::kLayersSize, C::kEmbeddingSize, C::kEmbeddingSize> wo;
+  TensorViewF<C::kLayersSize, C::kEmbeddingSize> feed_forward_norm;
+  TensorViewF<C::kLayersSize, C::kHiddenDim, C::kEmbeddingSize> w1;
+  TensorViewF<C::kLayersSize, C::kEmbeddingSize, C::kHiddenDim> w2;
+  TensorViewF<C::kLayersSize, C::kHiddenDim, C::kEmbeddingSize> w3;
+  TensorViewF<C::kEmbeddingSize> output_norm;
+  TensorViewF<C::kTokensSize, C::kEmbeddingSize> classifier;
+
+ private:
+  static constexpr size_t kTokenEmbeddingTableOffset = 0;
+  static constexpr size_t kAttentionNormOffset =
+      kTokenEmbeddingTableOffset + C::kTokensSize * C::kEmbeddingSize;
+  static constexpr size_t kQueryOffset =
+      kAttentionNormOffset + C::kLayersSize * C::kEmbeddingSize;
+  static constexpr size_t kKeyOffset =
+      kQueryOffset + C::kLayersSize * C::kEmbeddingSize * C::kEmbeddingSize;
+  static constexpr size_t kValueOffset =
+      kKeyOffset + C::kLayersSize * C::kKVDimension * C::kEmbeddingSize;
+  static constexpr size_t kOutputOffset =
+      kValueOffset + C::kLayersSize * C::kKVDimension * C::kEmbeddingSize;
+  static constexpr size_t kFeedForwardNormOffset =
+      kOutputOffset + C::kLayersSize * C::kEmbeddingSize * C::kEmbeddingSize;
+  static constexpr size_t kFeedForward1Offset =
+      kFeedForwardNormOffset + C::kLayersSize * C::kEmbeddingSize;
+  static constexpr size_t kFeedForward2Offset =
+      kFeedForward1Offset + C::kLayersSize * C::kHiddenDim * C::kEmbeddingSize;
+  static constexpr size_t kFeedForward3Offset =
+      kFeedForward2Offset + C::kLayersSize * C::kEmbeddingSize * C::kHiddenDim;
+  static constexpr size_t kOutputNormOffset =
+      kFeedForward3Offset + C::kLayersSize * C::kHiddenDim * C::kEmbeddingSize;
+  static_assert(kOutputNormOffset + C::kEmbeddingSize == C::kWeightsSize);
+};
@@ -0,0 +1,80 @@
+#include "src/ngram_drafter.h"
+
+#include <algorithm>
+
+#include "src/tensor.h"
+#include "src/trace.h"
+
+namespace {
+
+// FNV-1a hash of the token ids.
+uint64_t HashNgram(std::span<const int> ngram) {
+  uint64_t hash = 14695981039346656037ull;
+  for (int token : ngram) {
+    hash ^= static_cast<uint32_t>(token);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+}  // namespace
+
+NgramDrafter::NgramDrafter(size_t max_ngram, size_t min_ngram)
+    : max_ngram_(max_ngram),
+      min_ngram_(min_ngram),
+      indexes_(max_ngram + 1) {
+  CHECK(min_ngram > 0 && min_ngram <= max_ngram);
+}
+
+NgramDrafter::~NgramDrafter() = default;
+
+void NgramDrafter::Propose(std::span<const int> sequence,
+                           size_t max_tokens,
+                           float top_p,
+                           Sampler* sampler,
+                           std::vector<int>* tokens,
+                           std::vector<float>* probabilities) {
+  TRACE_EVENT("NgramDrafter::Propose");
+  tokens->clear();
+  probabilities->clear();
+  Index(sequence);
+
+  // Find the longest n-gram at the end of sequence that occurred before.
+  size_t size = sequence.size();
+  for (size_t n = std::min(max_ngram_, size); n >= min_ngram_; --n) {
+    std::span<const int> ngram = sequence.last(n);
+    auto it = indexes_[n].find(HashNgram(ngram));
+    if (it == indexes_[n].end())
+      continue;
+    size_t start = it->second;
+    // Ignore hash collisions.
+    if (!std::equal(ngram.begin(), ngram.end(),
+                    sequence.begin() + start - n)) {
+      continue;
+    }
+    // Copy the tokens followed the earlier occurrence.
+    size_t count = std::min(max_tokens, size - start);
+    tokens->assign(sequence.begin() + start,
+                   sequence.begin() + start + count);
+    return;
+  }
+}
+
+void NgramDrafter::Index(std::span<const int> sequence) {
+  // Start over when the sequence is not a continuation of the indexed one,
+  // i.e. after the engine is reset.
+  if (indexed_.size() > sequence.size() ||
+      !std::equal(indexed_.begin(), indexed_.end(), sequence.begin())) {
+    indexed_.clear();
+    for (auto& index : indexes_)
+      index.clear();
+  }
+  // The n-grams ending at the last token are not followed by any token yet,
+  // and they are indexed in next call.
+  for (size_t end = std::max<size_t>(indexed_.size(), 1);
+       end < sequence.size(); ++end) {
+    for (size_t n = min_ngram_; n <= std::min(max_ngram_, end); ++n)
+      indexes_[n][HashNgram(sequence.subspan(end - n, n))] = end;
+  }
+  indexed_.assign(sequence.begin(), sequence.end());
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "src/drafter.h"
+
+// Proposes tokens by finding the latest earlier occurrence of the last n-gram
+// of the sequence, and copying the tokens that followed it. This works well
+// when the output copies spans of the prompt or of itself, i.e. summarizing
+// or editing code, and needs no extra model.
+class NgramDrafter : public Drafter {
+ public:
+  // The longest n-gram that matches is used, from |max_ngram| tokens down to
+  // |min_ngram| tokens.
+  explicit NgramDrafter(size_t max_ngram = 3, size_t min_ngram = 1);
+  ~NgramDrafter() override;
+
+  // Drafter:
+  void Propose(std::span<const int> sequence,
+               size_t max_tokens,
+               float top_p,
+               Sampler* sampler,
+               std::vector<int>* tokens,
+               std::vector<float>* probabilities) override;
+
+ private:
+  // Add the n-grams of |sequence| that are not indexed yet.
+  void Index(std::span<const int> sequence);
+
+  const size_t max_ngram_;
+  const size_t min_ngram_;
+
+  // The indexed tokens.
+  std::vector<int> indexed_;
+
+  // For each n-gram size, map the hash of n-gram to the position after its
+  // latest occurrence. Only the n-grams followed by a token are indexed.
+  std::vector<std::unordered_map<uint64_t, size_t>> indexes_;
+};
@@ -0,0 +1,131 @@
+#include "src/perf_counters.h"
+
+#if defined(FROST_ENABLE_PERF_COUNTERS)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace profiler {
+
+namespace {
+
+#if defined(__linux__)
+
+constexpr uint64_t kEventConfigs[] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_STALLED_CYCLES_BACKEND,
+};
+static_assert(std::size(kEventConfigs) ==
+              static_cast<size_t>(Counter::kCount));
+
+// The counters of one thread, opened as a group so they are read together
+// with one syscall.
+class CounterGroup {
+ public:
+  CounterGroup() {
+    std::fill(std::begin(fds_), std::end(fds_), -1);
+    for (size_t i = 0; i < std::size(kEventConfigs); ++i) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = kEventConfigs[i];
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      int fd = syscall(SYS_perf_event_open, &attr, 0 /* this thread */,
+                       -1 /* any cpu */, leader_, 0);
+      if (fd < 0) {
+        // The leader must exist for other counters.
+        if (i == 0) {
+          fprintf(stderr, "perf_event_open failed, hardware counters are "
+                          "disabled: %s\n", strerror(errno));
+          return;
+        }
+        continue;
+      }
+      if (leader_ < 0)
+        leader_ = fd;
+      fds_[i] = fd;
+      ioctl(fd, PERF_EVENT_IOC_ID, &ids_[i]);
+      available_[i] = true;
+    }
+  }
+
+  ~CounterGroup() {
+    // Each counter of the group is a file of its own.
+    for (int fd : fds_) {
+      if (fd >= 0)
+        close(fd);
+    }
+  }
+
+  void Read(Counters* counters) {
+    if (leader_ < 0)
+      return;
+    struct {
+      uint64_t nr;
+      struct {
+        uint64_t value;
+        uint64_t id;
+      } values[std::size(kEventConfigs)];
+    } data;
+    if (read(leader_, &data, sizeof(data)) <= 0)
+      return;
+    for (uint64_t i = 0; i < data.nr; ++i) {
+      for (size_t j = 0; j < std::size(kEventConfigs); ++j) {
+        if (available_[j] && ids_[j] == data.values[i].id)
+          counters->values[j] = data.values[i].value;
+      }
+    }
+  }
+
+  bool available(Counter counter) const {
+    return available_[static_cast<int>(counter)];
+  }
+
+ private:
+  int leader_ = -1;
+  int fds_[std::size(kEventConfigs)];
+  uint64_t ids_[std::size(kEventConfigs)] = {};
+  bool available_[std::size(kEventConfigs)] = {};
+};
+
+CounterGroup& GetCounterGroup() {
+  thread_local CounterGroup group;
+  return group;
+}
+
+#endif  // defined(__linux__)
+
+}  // namespace
+
+void ReadCounters(Counters* counters) {
+#if defined(__linux__)
+  GetCounterGroup().Read(counters);
+#endif
+}
+
+bool IsCounterAvailable(Counter counter) {
+#if defined(__linux__)
+  return GetCounterGroup().available(counter);
+#else
+  return false;
+#endif
+}
+
+}  // namespace profiler
+
+#endif  // defined(FROST_ENABLE_PERF_COUNTERS)
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+namespace profiler {
+
+// Hardware counters read with perf_event_open on Linux, which are collected
+// for each operation when FROST_ENABLE_PERF_COUNTERS is defined (the
+// frost_enable_perf_counters GN arg).
+enum class Counter {
+  kCycles,
+  kInstructions,
+  // Misses of the last level cache.
+  kCacheMisses,
+  // Cycles stalled in the backend, which are mostly waiting for memory.
+  kStalledCyclesBackend,
+  kCount,
+};
+
+struct Counters {
+  uint64_t values[static_cast<int>(Counter::kCount)] = {};
+
+  uint64_t operator[](Counter counter) const {
+    return values[static_cast<int>(counter)];
+  }
+
+  Counters& operator+=(const Counters& other) {
+    for (int i = 0; i < static_cast<int>(Counter::kCount); ++i)
+      values[i] += other.values[i];
+    return *this;
+  }
+
+  Counters operator-(const Counters& other) const {
+    Counters result;
+    for (int i = 0; i < static_cast<int>(Counter::kCount); ++i)
+      result.values[i] = values[i] - other.values[i];
+    return result;
+  }
+};
+
+// Read the counters of current thread, the counters not supported by the
+// host are always 0.
+void ReadCounters(Counters* counters);
+
+// Whether |counter| can be read on this host.
+bool IsCounterAvailable(Counter counter);
+
+}  // namespace profiler
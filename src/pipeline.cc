@@ -0,0 +1,78 @@
+#include "src/pipeline.h"
+
+#include <latch>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "src/model_common.h"
+
+namespace {
+
+// Pushed through the pipeline to stop the threads.
+constexpr size_t kStop = static_cast<size_t>(-1);
+
+// Pin current thread to |cpu|, which is ignored when it does not exist.
+void PinThread(int cpu) {
+#if defined(__linux__)
+  if (cpu < 0 || cpu >= CPU_SETSIZE)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+}  // namespace
+
+Pipeline::Pipeline(size_t stages,
+                   Function function,
+                   StartFunction start,
+                   std::span<const int> cpus)
+    : function_(std::move(function)) {
+  CHECK_GT(stages, 0);
+  for (size_t i = 0; i <= stages; ++i)
+    queues_.push_back(std::make_unique<SpscQueue>());
+  std::latch started(stages);
+  for (size_t i = 0; i < stages; ++i) {
+    int cpu = i < cpus.size() ? cpus[i] : -1;
+    threads_.emplace_back([this, i, cpu, &start, &started] {
+      PinThread(cpu);
+      if (start)
+        start(i);
+      started.count_down();
+      RunStage(i);
+    });
+  }
+  started.wait();
+}
+
+Pipeline::~Pipeline() {
+  queues_.front()->Push(kStop);
+  for (std::thread& thread : threads_)
+    thread.join();
+}
+
+void Pipeline::Run(size_t count) {
+  CHECK_LT(count, SpscQueue::kCapacity);
+  for (size_t i = 0; i < count; ++i)
+    queues_.front()->Push(i);
+  for (size_t i = 0; i < count; ++i)
+    queues_.back()->Pop();
+}
+
+void Pipeline::RunStage(size_t stage) {
+  SpscQueue* input = queues_[stage].get();
+  SpscQueue* output = queues_[stage + 1].get();
+  while (true) {
+    size_t item = input->Pop();
+    if (item != kStop)
+      function_(stage, item);
+    output->Push(item);
+    if (item == kStop)
+      break;
+  }
+}
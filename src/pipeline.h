@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <span>
+#include <thread>
+#include <vector>
+
+// A lock-free queue of indices between one producer thread and one consumer
+// thread. The consumer sleeps on the queue until there is an item.
+class SpscQueue {
+ public:
+  static constexpr size_t kCapacity = 16;
+
+  // Append |item|, waiting while the queue is full.
+  void Push(size_t item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    while (tail - head == kCapacity) {
+      head_.wait(head, std::memory_order_acquire);
+      head = head_.load(std::memory_order_acquire);
+    }
+    items_[tail % kCapacity] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    tail_.notify_one();
+  }
+
+  // Remove and return the first item, waiting while the queue is empty.
+  size_t Pop() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    while (tail == head) {
+      tail_.wait(tail, std::memory_order_acquire);
+      tail = tail_.load(std::memory_order_acquire);
+    }
+    size_t item = items_[head % kCapacity];
+    head_.store(head + 1, std::memory_order_release);
+    head_.notify_one();
+    return item;
+  }
+
+ private:
+  // The producer and consumer write to different cache lines.
+  alignas(64) std::atomic<size_t> head_ = 0;
+  alignas(64) std::atomic<size_t> tail_ = 0;
+  std::array<size_t, kCapacity> items_;
+};
+
+// Runs items through a chain of stages, each one on its own thread, so the
+// stages work on different items at the same time, like an assembly line.
+// The items are passed from a stage to the next one through a SpscQueue.
+//
+// The models split the decoders into contiguous groups of stages and the
+// tokens of a pass into micro-batches, so each thread only reads the weights
+// of its own decoders, which stay in the cache of its core for small models.
+class Pipeline {
+ public:
+  // Called with the stage and the item on the thread of the stage.
+  using Function = std::function<void(size_t stage, size_t item)>;
+  // Called with the stage on the thread of the stage before it runs items,
+  // which is where the stage should allocate its buffers so their pages are
+  // on the NUMA node of its CPU.
+  using StartFunction = std::function<void(size_t stage)>;
+
+  // The thread of stage i is pinned to |cpus[i]| on Linux when it exists,
+  // otherwise it can run on any CPU. Return after |start| returns on all the
+  // stages.
+  Pipeline(size_t stages,
+           Function function,
+           StartFunction start = nullptr,
+           std::span<const int> cpus = {});
+  ~Pipeline();
+
+  Pipeline(const Pipeline&) = delete;
+  Pipeline& operator=(const Pipeline&) = delete;
+
+  // Run the items in [0, count) through all the stages in order, and return
+  // after the last stage finishes them. At most SpscQueue::kCapacity - 1
+  // items can be run at once.
+  void Run(size_t count);
+
+  size_t stages() const { return threads_.size(); }
+
+ private:
+  void RunStage(size_t stage);
+
+  const Function function_;
+  // The queue before each stage, and the one after the last stage.
+  std::vector<std::unique_ptr<SpscQueue>> queues_;
+  std::vector<std::thread> threads_;
+};
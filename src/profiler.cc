@@ -0,0 +1,165 @@
+#include "src/profiler.h"
+
+#if defined(FROST_ENABLE_PROFILER)
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace profiler {
+
+namespace {
+
+struct Stats {
+  uint64_t calls = 0;
+  uint64_t nanoseconds = 0;
+  uint64_t bytes = 0;
+  Counters counters;
+};
+
+// The layers of all the compiled models share the rows, which are more than
+// any LLaMA model has, and the last row is for operations outside decoders.
+constexpr size_t kMaxLayersSize = 128;
+constexpr size_t kRowsSize = kMaxLayersSize + 1;
+using Table = std::array<std::array<Stats, kRowsSize>,
+                         static_cast<size_t>(Op::kCount)>;
+
+// Each thread writes to its own table, which are summed when reporting.
+class Registry {
+ public:
+  ~Registry() { Report(); }
+
+  Table* NewTable() {
+    std::lock_guard lock(mutex_);
+#if defined(FROST_ENABLE_PERF_COUNTERS)
+    // Report() runs in the destruction of statics, after the thread_local
+    // counters of the main thread have been destroyed.
+    if (tables_.empty()) {
+      for (size_t i = 0; i < std::size(counter_available_); ++i)
+        counter_available_[i] = IsCounterAvailable(static_cast<Counter>(i));
+    }
+#endif
+    tables_.push_back(std::make_unique<Table>());
+    return tables_.back().get();
+  }
+
+ private:
+  void Report() {
+    Table total = {};
+    uint64_t total_nanoseconds = 0;
+    for (const auto& table : tables_) {
+      for (size_t op = 0; op < total.size(); ++op) {
+        for (size_t row = 0; row < kRowsSize; ++row) {
+          total[op][row].calls += (*table)[op][row].calls;
+          total[op][row].nanoseconds += (*table)[op][row].nanoseconds;
+          total[op][row].bytes += (*table)[op][row].bytes;
+          total[op][row].counters += (*table)[op][row].counters;
+          total_nanoseconds += (*table)[op][row].nanoseconds;
+        }
+      }
+    }
+    if (total_nanoseconds == 0)
+      return;
+    fprintf(stderr, "%-18s %6s %8s %10s %7s %12s %8s",
+            "op", "layer", "share", "time(ms)", "calls", "bytes(MB)", "GB/s");
+#if defined(FROST_ENABLE_PERF_COUNTERS)
+    fprintf(stderr, " %10s %6s %12s %7s", "Mcycles", "IPC", "LLC-misses",
+            "stalls");
+#endif
+    fprintf(stderr, "\n");
+    for (size_t op = 0; op < total.size(); ++op) {
+      for (size_t row = 0; row < kRowsSize; ++row) {
+        const Stats& stats = total[op][row];
+        if (stats.calls == 0)
+          continue;
+        char layer[8] = "-";
+        if (row < kMaxLayersSize)
+          snprintf(layer, sizeof(layer), "%zu", row);
+        fprintf(stderr, "%-18s %6s %7.2f%% %10.3f %7llu %12.3f %8.2f",
+                OpName(static_cast<Op>(op)), layer,
+                100. * stats.nanoseconds / total_nanoseconds,
+                stats.nanoseconds / 1e6,
+                static_cast<unsigned long long>(stats.calls),
+                stats.bytes / 1e6,
+                stats.nanoseconds ? 1. * stats.bytes / stats.nanoseconds : 0.);
+#if defined(FROST_ENABLE_PERF_COUNTERS)
+        PrintCounters(stats.counters);
+#endif
+        fprintf(stderr, "\n");
+      }
+    }
+  }
+
+#if defined(FROST_ENABLE_PERF_COUNTERS)
+  // A high share of stalled cycles with low IPC means the operation is bound
+  // by memory bandwidth, while a high IPC means it is bound by computation.
+  void PrintCounters(const Counters& counters) {
+    uint64_t cycles = counters[Counter::kCycles];
+    fprintf(stderr, " %10.3f", cycles / 1e6);
+    if (cycles > 0 && counter_available(Counter::kInstructions))
+      fprintf(stderr, " %6.2f", 1. * counters[Counter::kInstructions] / cycles);
+    else
+      fprintf(stderr, " %6s", "n/a");
+    if (counter_available(Counter::kCacheMisses))
+      fprintf(stderr, " %12llu", static_cast<unsigned long long>(
+                                     counters[Counter::kCacheMisses]));
+    else
+      fprintf(stderr, " %12s", "n/a");
+    if (cycles > 0 && counter_available(Counter::kStalledCyclesBackend))
+      fprintf(stderr, " %6.1f%%",
+              100. * counters[Counter::kStalledCyclesBackend] / cycles);
+    else
+      fprintf(stderr, " %7s", "n/a");
+  }
+
+  bool counter_available(Counter counter) const {
+    return counter_available_[static_cast<int>(counter)];
+  }
+#endif
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Table>> tables_;
+#if defined(FROST_ENABLE_PERF_COUNTERS)
+  bool counter_available_[static_cast<int>(Counter::kCount)] = {};
+#endif
+};
+
+Registry& GetRegistry() {
+  static Registry registry;
+  return registry;
+}
+
+thread_local Table* current_table = nullptr;
+thread_local int current_layer = -1;
+
+}  // namespace
+
+void Record(Op op, uint64_t nanoseconds, uint64_t bytes,
+            const Counters* counters) {
+  if (!current_table)
+    current_table = GetRegistry().NewTable();
+  size_t row = current_layer >= 0 ? current_layer : kMaxLayersSize;
+  row = std::min(row, kMaxLayersSize);
+  Stats& stats = (*current_table)[static_cast<size_t>(op)][row];
+  stats.calls++;
+  stats.nanoseconds += nanoseconds;
+  stats.bytes += bytes;
+  if (counters)
+    stats.counters += *counters;
+}
+
+ScopedLayer::ScopedLayer(int layer) : previous_(current_layer) {
+  current_layer = layer;
+}
+
+ScopedLayer::~ScopedLayer() {
+  current_layer = previous_;
+}
+
+}  // namespace profiler
+
+#endif  // defined(FROST_ENABLE_PROFILER)
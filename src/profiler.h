@@ -0,0 +1,139 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+
+#include "src/perf_counters.h"
+#include "src/trace.h"
+
+// A profiler of the operations in the hot path, compiled in when
+// FROST_ENABLE_PROFILER is defined (the frost_enable_profiler GN arg).
+//
+// The time, calls and bytes moved by each operation are recorded for each
+// decoder layer, and a report is printed to stderr at exit. When disabled the
+// macros expand to nothing so there is no cost at all.
+//
+// When FROST_ENABLE_PERF_COUNTERS is also defined, the hardware counters in
+// src/perf_counters.h are recorded too.
+//
+// When FROST_ENABLE_TRACING is defined, the layers and operations are also
+// recorded as trace events, see src/trace.h.
+//
+// Usage:
+//   PROFILE_LAYER(layer);  // attribute following operations in scope to layer
+//   PROFILE_OP(kSoftmax, bytes);  // time the rest of scope
+
+namespace profiler {
+
+enum class Op {
+  kMatrixProduct,
+  kAttentionScores,
+  kAttentionValues,
+  kSoftmax,
+  kRMSNormalize,
+  kRotaryEmbeddings,
+  kSwish,
+  kSampling,
+  kDetokenization,
+  kCount,
+};
+
+constexpr const char* OpName(Op op) {
+  constexpr const char* kNames[] = {
+    "MatrixProduct",
+    "AttentionScores",
+    "AttentionValues",
+    "Softmax",
+    "RMSNormalize",
+    "RotaryEmbeddings",
+    "Swish",
+    "Sampling",
+    "Detokenization",
+  };
+  static_assert(std::size(kNames) == static_cast<size_t>(Op::kCount));
+  return kNames[static_cast<size_t>(op)];
+}
+
+// Record an operation that took |nanoseconds| and moved |bytes|, with the
+// optional hardware |counters| spent.
+void Record(Op op, uint64_t nanoseconds, uint64_t bytes,
+            const Counters* counters = nullptr);
+
+// Operations recorded in the scope of this class are attributed to |layer|.
+class ScopedLayer {
+ public:
+  explicit ScopedLayer(int layer);
+  ~ScopedLayer();
+
+ private:
+  int previous_;
+};
+
+// Time the scope of this class.
+class ScopedOp {
+ public:
+  ScopedOp(Op op, uint64_t bytes) : op_(op), bytes_(bytes) {
+#if defined(FROST_ENABLE_PERF_COUNTERS)
+    ReadCounters(&counters_);
+#endif
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  ~ScopedOp() {
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    uint64_t nanoseconds = std::chrono::nanoseconds(elapsed).count();
+#if defined(FROST_ENABLE_PERF_COUNTERS)
+    Counters end;
+    ReadCounters(&end);
+    Counters spent = end - counters_;
+    Record(op_, nanoseconds, bytes_, &spent);
+#else
+    Record(op_, nanoseconds, bytes_);
+#endif
+  }
+
+ private:
+  Op op_;
+  uint64_t bytes_;
+  std::chrono::steady_clock::time_point start_;
+#if defined(FROST_ENABLE_PERF_COUNTERS)
+  Counters counters_;
+#endif
+};
+
+}  // namespace profiler
+
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+
+#if defined(FROST_ENABLE_PROFILER)
+#define PROFILE_LAYER_STATS(layer) \
+  profiler::ScopedLayer PROFILER_CONCAT(profile_layer_, __LINE__)(layer)
+#define PROFILE_OP_STATS(op, bytes) \
+  profiler::ScopedOp PROFILER_CONCAT(profile_op_, __LINE__)( \
+      profiler::Op::op, bytes)
+#else
+#define PROFILE_LAYER_STATS(layer) do {} while (0)
+#define PROFILE_OP_STATS(op, bytes) do {} while (0)
+#endif
+
+#if defined(FROST_ENABLE_TRACING)
+#define PROFILE_LAYER_TRACE(layer) \
+  trace::ScopedEvent PROFILER_CONCAT(trace_layer_, __LINE__)("Decoder", layer)
+#define PROFILE_OP_TRACE(op) \
+  trace::ScopedEvent PROFILER_CONCAT(trace_op_, __LINE__)( \
+      profiler::OpName(profiler::Op::op))
+#else
+#define PROFILE_LAYER_TRACE(layer) do {} while (0)
+#define PROFILE_OP_TRACE(op) do {} while (0)
+#endif
+
+// The trace events are declared first so they include the time of the stats.
+#define PROFILE_LAYER(layer) \
+  PROFILE_LAYER_TRACE(layer); \
+  PROFILE_LAYER_STATS(layer)
+#define PROFILE_OP(op, bytes) \
+  PROFILE_OP_TRACE(op); \
+  PROFILE_OP_STATS(op, bytes)
@@ -0,0 +1,212 @@
+#include "src/runtime_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+#include "src/kv_cache.h"
+#include "src/model_common.h"
+
+#include "models.h"  // generated header
+
+namespace runtime {
+
+namespace {
+
+// Number of independent partial sums in the generic dot product, which allows
+// the compiler to vectorize the loop without reassociating the additions.
+constexpr size_t kLanes = 16;
+
+float GenericDotProduct(const float* left, const float* right, size_t n) {
+  float sums[kLanes] = {};
+  size_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    for (size_t j = 0; j < kLanes; ++j)
+      sums[j] += left[i + j] * right[i + j];
+  }
+  float sum = 0;
+  for (; i < n; ++i)
+    sum += left[i] * right[i];
+  for (float partial : sums)
+    sum += partial;
+  return sum;
+}
+
+// Run the template specialized kernels of src/tensor.h for NxM matrices.
+template<size_t N, size_t M>
+void SpecializedMatrixProductTo(const float* matrix,
+                                const float* vector,
+                                float* out,
+                                size_t n,
+                                size_t m) {
+  TensorViewF<N, M> left(std::span<const float, N * M>(matrix, N * M));
+  TensorViewF<M> right(std::span<const float, M>(vector, M));
+  std::span<float, N> out_span(out, N);
+  MutableTensorViewF<N> result(out_span);
+  frost::MatrixProductTo(left, right, &result);
+}
+
+template<size_t N, size_t M>
+void SpecializedMatrixProductAddTo(const float* matrix,
+                                   const float* vector,
+                                   float* out,
+                                   size_t n,
+                                   size_t m) {
+  TensorViewF<N, M> left(std::span<const float, N * M>(matrix, N * M));
+  TensorViewF<M> right(std::span<const float, M>(vector, M));
+  std::span<float, N> out_span(out, N);
+  MutableTensorViewF<N> result(out_span);
+  frost::MatrixProductAddTo(left, right, &result);
+}
+
+struct SpecializedKernels {
+  size_t n;
+  size_t m;
+  MatrixProductFunction product_to;
+  MatrixProductFunction product_add_to;
+};
+
+template<size_t N, size_t M>
+constexpr SpecializedKernels MakeKernels() {
+  return {N, M,
+          &SpecializedMatrixProductTo<N, M>,
+          &SpecializedMatrixProductAddTo<N, M>};
+}
+
+// The kernels for the shapes of all matrices in compiled models.
+#define MODEL_KERNELS(C)                                                      \
+  MakeKernels<C::kEmbeddingSize, C::kEmbeddingSize>(),                        \
+  MakeKernels<C::kKVDimension, C::kEmbeddingSize>(),                          \
+  MakeKernels<C::kHiddenDim, C::kEmbeddingSize>(),                            \
+  MakeKernels<C::kEmbeddingSize, C::kHiddenDim>(),                            \
+  MakeKernels<C::kTokensSize, C::kEmbeddingSize>(),
+constexpr SpecializedKernels kSpecializedKernels[] = {
+  FROST_FOR_EACH_MODEL(MODEL_KERNELS)
+};
+#undef MODEL_KERNELS
+
+}  // namespace
+
+void GenericMatrixProductTo(const float* matrix,
+                            const float* vector,
+                            float* out,
+                            size_t n,
+                            size_t m) {
+  PROFILE_OP(kMatrixProduct, sizeof(float) * (n * m + m + n));
+  for (size_t i = 0; i < n; ++i)
+    out[i] = GenericDotProduct(matrix + i * m, vector, m);
+}
+
+void GenericMatrixProductAddTo(const float* matrix,
+                               const float* vector,
+                               float* out,
+                               size_t n,
+                               size_t m) {
+  PROFILE_OP(kMatrixProduct, sizeof(float) * (n * m + m + n));
+  for (size_t i = 0; i < n; ++i)
+    out[i] += GenericDotProduct(matrix + i * m, vector, m);
+}
+
+Matrix::Matrix(const float* data, size_t rows, size_t columns)
+    : data_(data),
+      rows_(rows),
+      columns_(columns),
+      product_to_(&GenericMatrixProductTo),
+      product_add_to_(&GenericMatrixProductAddTo) {
+  for (const SpecializedKernels& kernels : kSpecializedKernels) {
+    if (kernels.n == rows && kernels.m == columns) {
+      product_to_ = kernels.product_to;
+      product_add_to_ = kernels.product_add_to;
+      break;
+    }
+  }
+}
+
+void Matrix::ProductTo(std::span<const float> x, std::span<float> out) const {
+  CHECK_EQ(x.size(), columns_);
+  CHECK_EQ(out.size(), rows_);
+  product_to_(data_, x.data(), out.data(), rows_, columns_);
+}
+
+void Matrix::ProductAddTo(std::span<const float> x,
+                          std::span<float> out) const {
+  CHECK_EQ(x.size(), columns_);
+  CHECK_EQ(out.size(), rows_);
+  product_add_to_(data_, x.data(), out.data(), rows_, columns_);
+}
+
+void Matrix::RowsProductTo(std::span<const float> x,
+                           std::span<const int> rows,
+                           float fill,
+                           std::span<float> out) const {
+  CHECK_EQ(x.size(), columns_);
+  CHECK_EQ(out.size(), rows_);
+  PROFILE_OP(kMatrixProduct,
+             sizeof(float) * (rows.size() * columns_ + columns_ + rows_));
+  std::fill(out.begin(), out.end(), fill);
+  for (int row : rows)
+    out[row] = GenericDotProduct(data_ + row * columns_, x.data(), columns_);
+}
+
+bool Matrix::is_specialized() const {
+  return product_to_ != &GenericMatrixProductTo;
+}
+
+void RMSNormalize(std::span<const float> x,
+                  std::span<const float> weights,
+                  std::span<float> out) {
+  size_t n = x.size();
+  PROFILE_OP(kRMSNormalize, sizeof(float) * n * 3);
+  float sum_of_squres = 0;
+  for (size_t i = 0; i < n; ++i)
+    sum_of_squres += x[i] * x[i];
+  float rms = std::sqrt(sum_of_squres / n + 1e-5f);
+  for (size_t i = 0; i < n; ++i)
+    out[i] = weights[i] * x[i] / rms;
+}
+
+void ApplyRotaryEmbeddings(size_t position, std::span<float> x) {
+  size_t n = x.size();
+  PROFILE_OP(kRotaryEmbeddings, sizeof(float) * n * 2);
+  for (size_t i = 0; i < n; i += 2) {
+    std::complex<float> sibling(x[i], x[i + 1]);
+    float theta = std::pow(10000.f, -1.f * i / n);
+    std::complex<float> frequency = std::polar(1.f, position * theta);
+    std::complex<float> rotated = sibling * frequency;
+    x[i] = rotated.real();
+    x[i + 1] = rotated.imag();
+  }
+}
+
+void AttendHead(std::span<const float> query,
+                std::span<const float* const> keys,
+                std::span<const float* const> values,
+                size_t stride,
+                size_t kv_head,
+                size_t position,
+                std::span<float> scores,
+                std::span<float> output) {
+  size_t d = query.size();
+  {
+    PROFILE_OP(kAttentionScores, sizeof(float) * (position + 1) * (d + 1));
+    for (size_t past = 0; past <= position; ++past) {
+      const float* key = keys[past / KVCache::kBlockSize] +
+                         past % KVCache::kBlockSize * stride + kv_head * d;
+      scores[past] = GenericDotProduct(query.data(), key, d) / std::sqrt(d);
+    }
+  }
+  // Make the scores sum up to 1.
+  Softmax(scores.begin(), scores.begin() + position + 1);
+
+  PROFILE_OP(kAttentionValues, sizeof(float) * (position + 1) * (d + 1));
+  std::fill(output.begin(), output.end(), 0);
+  for (size_t past = 0; past <= position; ++past) {
+    const float* value = values[past / KVCache::kBlockSize] +
+                         past % KVCache::kBlockSize * stride + kv_head * d;
+    float score = scores[past];
+    for (size_t i = 0; i < d; ++i)
+      output[i] += value[i] * score;
+  }
+}
+
+}  // namespace runtime
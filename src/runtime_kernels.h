@@ -0,0 +1,81 @@
+#pragma once
+
+#include <span>
+
+// Kernels for tensors whose shapes are only known at runtime, which are used by
+// the models loaded from checkpoints.
+namespace runtime {
+
+// Signature of the product of NxM |matrix| and M |vector|, whose result is
+// written or added to |out|.
+using MatrixProductFunction = void (*)(const float* matrix,
+                                       const float* vector,
+                                       float* out,
+                                       size_t n,
+                                       size_t m);
+
+// The kernels that work with any shape.
+void GenericMatrixProductTo(const float* matrix,
+                            const float* vector,
+                            float* out,
+                            size_t n,
+                            size_t m);
+void GenericMatrixProductAddTo(const float* matrix,
+                               const float* vector,
+                               float* out,
+                               size_t n,
+                               size_t m);
+
+// A row-major matrix of weights, whose product kernels are picked once for its
+// shape: the kernels specialized for the shapes of compiled models are used
+// when shape matches, otherwise the generic kernels.
+class Matrix {
+ public:
+  Matrix(const float* data, size_t rows, size_t columns);
+
+  // Write the product of the matrix and |x| to |out|.
+  void ProductTo(std::span<const float> x, std::span<float> out) const;
+  // Add the product of the matrix and |x| to |out|.
+  void ProductAddTo(std::span<const float> x, std::span<float> out) const;
+  // Write the products of the sorted |rows| of the matrix and |x| to the same
+  // indices of |out|, and |fill| to the other indices.
+  void RowsProductTo(std::span<const float> x,
+                     std::span<const int> rows,
+                     float fill,
+                     std::span<float> out) const;
+
+  // Whether the specialized kernels are used.
+  bool is_specialized() const;
+
+  const float* data() const { return data_; }
+  size_t rows() const { return rows_; }
+  size_t columns() const { return columns_; }
+
+ private:
+  const float* data_;
+  size_t rows_;
+  size_t columns_;
+  MatrixProductFunction product_to_;
+  MatrixProductFunction product_add_to_;
+};
+
+// Same with the functions in src/model_common.h.
+void RMSNormalize(std::span<const float> x,
+                  std::span<const float> weights,
+                  std::span<float> out);
+void ApplyRotaryEmbeddings(size_t position, std::span<float> x);
+
+// Compute the attention of a single head like AttendHead in
+// src/model_common.h, the |keys| and |values| are blocks of KVCache, each one
+// indexed by [position][kv_head][head_dimension] with |stride| floats per
+// position.
+void AttendHead(std::span<const float> query,
+                std::span<const float* const> keys,
+                std::span<const float* const> values,
+                size_t stride,
+                size_t kv_head,
+                size_t position,
+                std::span<float> scores,
+                std::span<float> output);
+
+}  // namespace runtime
@@ -0,0 +1,432 @@
+#include "src/runtime_transformer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "src/model_common.h"
+#include "src/trace.h"
+
+RuntimeTransformer::RuntimeTransformer(
+    std::string name,
+    const ModelShape& shape,
+    const float* weights,
+    const float* classifier,
+    std::unique_ptr<Communicator> communicator)
+    : name_(std::move(name)),
+      shape_(shape),
+      communicator_(std::move(communicator)),
+      head_dimension_(shape.embedding_size / shape.heads_size),
+      heads_(shape.heads_size / ranks()),
+      kv_heads_(shape.kv_heads_size / ranks()),
+      kv_dimension_(kv_heads_ * head_dimension_),
+      hidden_dim_(shape.hidden_dim / ranks()),
+      token_embedding_table_(weights),
+      classifier_(classifier ? classifier : weights,
+                  shape.tokens_size, shape.embedding_size),
+      kv_cache_(shape.layers_size, kv_dimension_, shape.sequence_size),
+      residual_(kMaxBatchSize * shape.embedding_size),
+      scratches_(1, Scratch(shape.embedding_size, heads_ * head_dimension_,
+                            shape.sequence_size, hidden_dim_)),
+      logits_(kMaxBatchSize * shape.tokens_size),
+      shard_outputs_(communicator_ ? kMaxBatchSize * shape.embedding_size : 0),
+      hidden_states_(kMaxBatchSize * shape.embedding_size),
+      early_exit_(kMaxBatchSize * shape.embedding_size) {
+  CHECK(shape.heads_size % ranks() == 0 &&
+        shape.kv_heads_size % ranks() == 0 && shape.hidden_dim % ranks() == 0);
+  size_t dim = shape.embedding_size;
+  size_t hidden_dim = shape.hidden_dim;
+  size_t kv_dimension = shape.kv_heads_size * head_dimension_;
+  size_t layers = shape.layers_size;
+  // Each kind of weights is stored for all layers one after another.
+  const float* next = weights + shape.tokens_size * dim;
+  auto take = [&next](size_t size) {
+    const float* result = next;
+    next += size;
+    return result;
+  };
+  const float* attention_norm = take(layers * dim);
+  const float* wq = take(layers * dim * dim);
+  const float* wk = take(layers * kv_dimension * dim);
+  const float* wv = take(layers * kv_dimension * dim);
+  const float* wo = take(layers * dim * dim);
+  const float* feed_forward_norm = take(layers * dim);
+  const float* w1 = take(layers * hidden_dim * dim);
+  const float* w2 = take(layers * dim * hidden_dim);
+  const float* w3 = take(layers * hidden_dim * dim);
+  output_norm_ = std::span<const float>(take(dim), dim);
+
+  // The shard has the rows of wq, wk, wv, w1 and w3 that compute its heads
+  // and hidden units, and the columns of wo and w2 that read them.
+  size_t rank = communicator_ ? communicator_->rank() : 0;
+  size_t query_dimension = heads_ * head_dimension_;
+  size_t query_offset = rank * query_dimension;
+  size_t kv_offset = rank * kv_dimension_;
+  size_t hidden_offset = rank * hidden_dim_;
+  auto columns = [this](const float* matrix, size_t rows, size_t columns,
+                        size_t offset, size_t count) {
+    if (count == columns)
+      return runtime::Matrix(matrix, rows, columns);
+    std::vector<float>& shard = shard_weights_.emplace_back(rows * count);
+    for (size_t row = 0; row < rows; ++row) {
+      std::copy_n(matrix + row * columns + offset, count,
+                  shard.begin() + row * count);
+    }
+    return runtime::Matrix(shard.data(), rows, count);
+  };
+
+  layers_.reserve(layers);
+  for (size_t i = 0; i < layers; ++i) {
+    layers_.push_back({
+      std::span<const float>(attention_norm + i * dim, dim),
+      runtime::Matrix(wq + i * dim * dim + query_offset * dim,
+                      query_dimension, dim),
+      runtime::Matrix(wk + i * kv_dimension * dim + kv_offset * dim,
+                      kv_dimension_, dim),
+      runtime::Matrix(wv + i * kv_dimension * dim + kv_offset * dim,
+                      kv_dimension_, dim),
+      columns(wo + i * dim * dim, dim, dim, query_offset, query_dimension),
+      std::span<const float>(feed_forward_norm + i * dim, dim),
+      runtime::Matrix(w1 + i * hidden_dim * dim + hidden_offset * dim,
+                      hidden_dim_, dim),
+      columns(w2 + i * dim * hidden_dim, dim, hidden_dim, hidden_offset,
+              hidden_dim_),
+      runtime::Matrix(w3 + i * hidden_dim * dim + hidden_offset * dim,
+                      hidden_dim_, dim),
+    });
+  }
+}
+
+RuntimeTransformer::~RuntimeTransformer() = default;
+
+RuntimeTransformer::Scratch::Scratch(size_t embedding_size,
+                                     size_t query_dimension,
+                                     size_t sequence_size,
+                                     size_t hidden_dim)
+    : normalized(embedding_size),
+      queries(query_dimension),
+      scores(sequence_size),
+      attention(query_dimension),
+      gate(hidden_dim),
+      hidden(hidden_dim) {}
+
+// static
+size_t RuntimeTransformer::GetWeightsSize(const ModelShape& shape) {
+  size_t dim = shape.embedding_size;
+  size_t kv_dimension = dim / shape.heads_size * shape.kv_heads_size;
+  size_t layer_size = 2 * dim +
+                      dim * dim * 2 +
+                      kv_dimension * dim * 2 +
+                      shape.hidden_dim * dim * 3;
+  return shape.tokens_size * dim + shape.layers_size * layer_size + dim;
+}
+
+std::span<float> RuntimeTransformer::Forward(
+    std::span<const int> tokens,
+    std::span<const int> sequences,
+    std::span<const size_t> positions) {
+  TRACE_EVENT("Transformer::Forward");
+  size_t count = RunTokens(tokens, sequences, positions);
+  size_t vocab = shape_.tokens_size;
+  std::span<float> logits(logits_.data(), count * vocab);
+  for (size_t b = 0; b < count; ++b)
+    ComputeLogits(b, logits.subspan(b * vocab, vocab));
+  return logits;
+}
+
+std::span<float> RuntimeTransformer::ForwardHidden(
+    std::span<const int> tokens,
+    std::span<const int> sequences,
+    std::span<const size_t> positions) {
+  TRACE_EVENT("Transformer::ForwardHidden");
+  size_t count = RunTokens(tokens, sequences, positions);
+  size_t dim = shape_.embedding_size;
+  std::span<float> hidden(hidden_states_.data(), count * dim);
+  for (size_t b = 0; b < count; ++b) {
+    runtime::RMSNormalize(residual(b), output_norm_,
+                          hidden.subspan(b * dim, dim));
+  }
+  return hidden;
+}
+
+void RuntimeTransformer::Fork(int parent, int child, size_t size) {
+  kv_cache_.Fork(parent, child, size);
+}
+
+void RuntimeTransformer::Release(int sequence) {
+  kv_cache_.Release(sequence);
+}
+
+void RuntimeTransformer::FeedEarlyExit(int token,
+                                       size_t position,
+                                       size_t layers) {
+  TRACE_EVENT("Transformer::FeedEarlyExit");
+  CHECK(token >= 0 && token < shape_.tokens_size);
+  CHECK(layers > 0 && layers < layers_.size());
+  CHECK_LT(position, static_cast<size_t>(shape_.sequence_size));
+  if (early_exit_count_ == 0) {
+    early_exit_layers_ = layers;
+    early_exit_position_ = position;
+  }
+  CHECK_EQ(layers, early_exit_layers_);
+  CHECK_EQ(position, early_exit_position_ + early_exit_count_);
+  CHECK_LT(early_exit_count_, kMaxBatchSize);
+  size_t dim = shape_.embedding_size;
+  std::copy_n(token_embedding_table_ + token * dim, dim, residual(0).begin());
+  Batch batch;
+  batch.count = 1;
+  batch.sequences[0] = 0;
+  batch.positions[0] = position;
+  RunDecoders(0, layers, batch);
+  // Remember the output so the rest decoders can continue from it.
+  std::copy_n(residual(0).begin(), dim,
+              early_exit_.begin() + early_exit_count_++ * dim);
+}
+
+std::span<float> RuntimeTransformer::EarlyExitLogits() {
+  CHECK_GT(early_exit_count_, 0);
+  // The first row of residual stream still has the output of last token.
+  std::span<float> logits(logits_.data(), shape_.tokens_size);
+  ComputeLogits(0, logits);
+  return logits;
+}
+
+std::span<float> RuntimeTransformer::FinishEarlyExit() {
+  TRACE_EVENT("Transformer::FinishEarlyExit");
+  size_t count = early_exit_count_;
+  CHECK_GT(count, 0);
+  size_t dim = shape_.embedding_size;
+  size_t vocab = shape_.tokens_size;
+  Batch batch;
+  batch.count = count;
+  for (size_t b = 0; b < count; ++b) {
+    batch.sequences[b] = 0;
+    batch.positions[b] = early_exit_position_ + b;
+    std::copy_n(early_exit_.begin() + b * dim, dim, residual(b).begin());
+  }
+  RunDecoders(early_exit_layers_, layers_.size(), batch);
+  early_exit_count_ = 0;
+  std::span<float> logits(logits_.data(), count * vocab);
+  for (size_t b = 0; b < count; ++b)
+    ComputeLogits(b, logits.subspan(b * vocab, vocab));
+  return logits;
+}
+
+void RuntimeTransformer::EnablePipeline(size_t stages,
+                                        std::span<const int> cpus) {
+  // The shards all-reduce after each decoder, which the stages can not do at
+  // the same time.
+  if (communicator_)
+    return;
+  stages = std::clamp<size_t>(stages, 1, std::min(layers_.size(),
+                                                  kMaxBatchSize));
+  pipeline_.reset();
+  if (stages == 1) {
+    scratches_.resize(1, scratches_[0]);
+    return;
+  }
+  // The scratches are allocated again by the stages, which first touch them.
+  scratches_.resize(stages, scratches_[0]);
+  pipeline_ = std::make_unique<Pipeline>(
+      stages,
+      [this](size_t stage, size_t micro_batch) {
+        RunStage(stage, micro_batch);
+      },
+      [this](size_t stage) {
+        scratches_[stage] = Scratch(shape_.embedding_size,
+                                    heads_ * head_dimension_,
+                                    shape_.sequence_size, hidden_dim_);
+      },
+      cpus);
+}
+
+size_t RuntimeTransformer::RunTokens(std::span<const int> tokens,
+                                     std::span<const int> sequences,
+                                     std::span<const size_t> positions) {
+  Batch batch;
+  batch.count = tokens.size();
+  CHECK(batch.count > 0 && batch.count <= kMaxBatchSize);
+  CHECK(sequences.size() == batch.count && positions.size() == batch.count);
+  size_t dim = shape_.embedding_size;
+  for (size_t b = 0; b < batch.count; ++b) {
+    CHECK(tokens[b] >= 0 && tokens[b] < shape_.tokens_size);
+    CHECK_LT(positions[b], static_cast<size_t>(shape_.sequence_size));
+    batch.sequences[b] = sequences[b];
+    batch.positions[b] = positions[b];
+    // Encode the tokens into embeddings.
+    std::copy_n(token_embedding_table_ + tokens[b] * dim, dim,
+                residual(b).begin());
+  }
+  RunDecoders(0, layers_.size(), batch);
+  return batch.count;
+}
+
+void RuntimeTransformer::RunDecoders(size_t begin,
+                                     size_t end,
+                                     const Batch& batch) {
+  if (communicator_) {
+    RunShardedDecoders(begin, end, batch);
+    return;
+  }
+  if (pipeline_ && batch.count > 1 && !layer_streaming()) {
+    TRACE_EVENT("Transformer::RunPipeline");
+    // The stages write the KV cache of different layers at the same time.
+    kv_cache_.Reserve(begin, end, batch);
+    // Split the rows into contiguous micro-batches, so the tokens of a
+    // sequence are still fed in order.
+    size_t count = std::min(batch.count, pipeline_->stages());
+    for (size_t m = 0; m <= count; ++m)
+      micro_rows_[m] = m * batch.count / count;
+    pipeline_batch_ = &batch;
+    pipeline_begin_ = begin;
+    pipeline_end_ = end;
+    pipeline_->Run(count);
+    return;
+  }
+  // Each residual block adds its result to the residual stream. All tokens
+  // run a decoder before the next one, so its weights are read once for them.
+  for (size_t i = begin; i < end; ++i) {
+    PROFILE_LAYER(i);
+    BeginLayer(i);
+    for (size_t b = 0; b < batch.count; ++b) {
+      RunDecoder(i, batch.sequences[b], batch.positions[b], b,
+                 &scratches_[0]);
+    }
+    EndLayer(i);
+  }
+}
+
+void RuntimeTransformer::RunShardedDecoders(size_t begin,
+                                            size_t end,
+                                            const Batch& batch) {
+  size_t dim = shape_.embedding_size;
+  std::span<float> outputs(shard_outputs_.data(), batch.count * dim);
+  Scratch* scratch = &scratches_[0];
+  // Sum the outputs of all shards and add them to the residual stream, in one
+  // all-reduce for all tokens.
+  auto add_outputs = [&](auto&& compute) {
+    std::fill(outputs.begin(), outputs.end(), 0.f);
+    for (size_t b = 0; b < batch.count; ++b)
+      compute(b, outputs.subspan(b * dim, dim));
+    communicator_->AllReduce(outputs);
+    for (size_t i = 0; i < outputs.size(); ++i)
+      residual_[i] += outputs[i];
+  };
+  for (size_t i = begin; i < end; ++i) {
+    PROFILE_LAYER(i);
+    BeginLayer(i);
+    add_outputs([&](size_t b, std::span<float> output) {
+      runtime::RMSNormalize(residual(b), layers_[i].attention_norm,
+                            scratch->normalized);
+      Attention(i, batch.sequences[b], batch.positions[b], output, scratch);
+    });
+    add_outputs([&](size_t b, std::span<float> output) {
+      runtime::RMSNormalize(residual(b), layers_[i].feed_forward_norm,
+                            scratch->normalized);
+      FeedForward(i, output, scratch);
+    });
+    EndLayer(i);
+  }
+}
+
+void RuntimeTransformer::RunDecoder(size_t layer,
+                                    int sequence,
+                                    size_t position,
+                                    size_t row,
+                                    Scratch* scratch) {
+  std::span<float> x = residual(row);
+  runtime::RMSNormalize(x, layers_[layer].attention_norm, scratch->normalized);
+  Attention(layer, sequence, position, x, scratch);
+  runtime::RMSNormalize(x, layers_[layer].feed_forward_norm,
+                        scratch->normalized);
+  FeedForward(layer, x, scratch);
+}
+
+void RuntimeTransformer::RunStage(size_t stage, size_t micro_batch) {
+  size_t layers = layers_.size();
+  size_t stages = pipeline_->stages();
+  size_t begin = std::max(pipeline_begin_, stage * layers / stages);
+  size_t end = std::min(pipeline_end_, (stage + 1) * layers / stages);
+  const Batch& batch = *pipeline_batch_;
+  for (size_t i = begin; i < end; ++i) {
+    PROFILE_LAYER(i);
+    for (size_t b = micro_rows_[micro_batch];
+         b < micro_rows_[micro_batch + 1]; ++b) {
+      RunDecoder(i, batch.sequences[b], batch.positions[b], b,
+                 &scratches_[micro_batch]);
+    }
+  }
+}
+
+void RuntimeTransformer::ComputeLogits(size_t row, std::span<float> logits) {
+  std::vector<float>& normalized = scratches_[0].normalized;
+  runtime::RMSNormalize(residual(row), output_norm_, normalized);
+  if (allowed_tokens().empty()) {
+    classifier_.ProductTo(normalized, logits);
+  } else {
+    classifier_.RowsProductTo(normalized, allowed_tokens(), kMaskedLogit,
+                              logits);
+  }
+}
+
+void RuntimeTransformer::Attention(size_t layer,
+                                   int sequence,
+                                   size_t position,
+                                   std::span<float> residual,
+                                   Scratch* scratch) {
+  TRACE_EVENT("SelfAttention");
+  const Layer& weights = layers_[layer];
+  size_t heads = heads_;
+  size_t kv_heads = kv_heads_;
+  // Compute queries, keys and values at the |position|, and remember the keys
+  // and values to cache.
+  std::span<float> queries(scratch->queries);
+  weights.wq.ProductTo(scratch->normalized, queries);
+  auto [layer_keys, layer_values] = kv_cache_.Write(layer, sequence, position);
+  std::span<float> keys(layer_keys, kv_dimension_);
+  std::span<float> values(layer_values, kv_dimension_);
+  weights.wk.ProductTo(scratch->normalized, keys);
+  weights.wv.ProductTo(scratch->normalized, values);
+
+  // Apply RoPE positional encoding to each head.
+  for (size_t i = 0; i < heads; ++i) {
+    runtime::ApplyRotaryEmbeddings(
+        position, queries.subspan(i * head_dimension_, head_dimension_));
+  }
+  for (size_t i = 0; i < kv_heads; ++i) {
+    runtime::ApplyRotaryEmbeddings(
+        position, keys.subspan(i * head_dimension_, head_dimension_));
+  }
+
+  // Compute grouped attention.
+  std::span<float> attention(scratch->attention);
+  for (size_t head = 0; head < heads; ++head) {
+    size_t kv_head = head / (heads / kv_heads);
+    runtime::AttendHead(
+        queries.subspan(head * head_dimension_, head_dimension_),
+        kv_cache_.keys(layer, sequence), kv_cache_.values(layer, sequence),
+        kv_dimension_, kv_head, position, scratch->scores,
+        attention.subspan(head * head_dimension_, head_dimension_));
+  }
+
+  // Project the heads back to embedding and add it to the residual stream.
+  weights.wo.ProductAddTo(scratch->attention, residual);
+}
+
+void RuntimeTransformer::FeedForward(size_t layer,
+                                     std::span<float> residual,
+                                     Scratch* scratch) {
+  TRACE_EVENT("FeedForward");
+  const Layer& weights = layers_[layer];
+  std::vector<float>& gate = scratch->gate;
+  std::vector<float>& hidden = scratch->hidden;
+  weights.w1.ProductTo(scratch->normalized, gate);
+  {
+    PROFILE_OP(kSwish, sizeof(float) * gate.size() * 2);
+    for (float& val : gate)
+      val /= 1.f + std::exp(-val);
+  }
+  weights.w3.ProductTo(scratch->normalized, hidden);
+  for (size_t i = 0; i < hidden.size(); ++i)
+    hidden[i] *= gate[i];
+  weights.w2.ProductAddTo(hidden, residual);
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/communicator.h"
+#include "src/language_model.h"
+#include "src/pipeline.h"
+#include "src/runtime_kernels.h"
+
+// A transformer whose shapes are read from the checkpoint at runtime, which can
+// run any llama2.c model without rebuilding. The matrix products still use the
+// specialized kernels when shapes match the ones of compiled models.
+class RuntimeTransformer : public LanguageModel {
+ public:
+  // The |weights| are in the llama2.c layout (see src/model_weights.h), which
+  // must outlive the model. When |classifier| is not null, it is used for
+  // computing logits instead of the token embedding table.
+  //
+  // With a |communicator| the model is a shard of tensor parallel inference:
+  // the heads and the hidden units of feed forward are split evenly among the
+  // ranks, and each rank only computes and caches the ones of its own. The
+  // outputs of attention and feed forward are all-reduced before adding to
+  // the residual stream, so every rank has the same residual stream, and the
+  // embedding and classifier are computed by every rank.
+  RuntimeTransformer(std::string name,
+                     const ModelShape& shape,
+                     const float* weights,
+                     const float* classifier,
+                     std::unique_ptr<Communicator> communicator = nullptr);
+  ~RuntimeTransformer() override;
+
+  // How many floats the weights of |shape| have, which does not include the
+  // classifier.
+  static size_t GetWeightsSize(const ModelShape& shape);
+
+  // LanguageModel:
+  const char* name() const override { return name_.c_str(); }
+  const ModelShape& shape() const override { return shape_; }
+  std::span<float> Forward(std::span<const int> tokens,
+                           std::span<const int> sequences,
+                           std::span<const size_t> positions) override;
+  using LanguageModel::Forward;
+  std::span<float> ForwardHidden(std::span<const int> tokens,
+                                 std::span<const int> sequences,
+                                 std::span<const size_t> positions) override;
+  void Fork(int parent, int child, size_t size) override;
+  void Release(int sequence) override;
+  void FeedEarlyExit(int token, size_t position, size_t layers) override;
+  std::span<float> EarlyExitLogits() override;
+  std::span<float> FinishEarlyExit() override;
+  void EnablePipeline(size_t stages, std::span<const int> cpus) override;
+
+ private:
+  // The weights of a decoder layer.
+  struct Layer {
+    std::span<const float> attention_norm;
+    runtime::Matrix wq;
+    runtime::Matrix wk;
+    runtime::Matrix wv;
+    runtime::Matrix wo;
+    std::span<const float> feed_forward_norm;
+    runtime::Matrix w1;
+    runtime::Matrix w2;
+    runtime::Matrix w3;
+  };
+
+  // Buffers of activations used inside a decoder, same with the ones in
+  // Workspace.
+  struct Scratch {
+    Scratch(size_t embedding_size,
+            size_t query_dimension,
+            size_t sequence_size,
+            size_t hidden_dim);
+
+    std::vector<float> normalized;
+    std::vector<float> queries;
+    std::vector<float> scores;
+    std::vector<float> attention;
+    std::vector<float> gate;
+    std::vector<float> hidden;
+  };
+
+  // Encode |tokens| into the rows of residual stream and feed them through
+  // all the decoders, return how many tokens there are.
+  size_t RunTokens(std::span<const int> tokens,
+                   std::span<const int> sequences,
+                   std::span<const size_t> positions);
+  // Feed the rows of residual stream for |batch| through the decoders in
+  // [begin, end).
+  void RunDecoders(size_t begin, size_t end, const Batch& batch);
+  // Same with RunDecoders but sum the outputs of the shards.
+  void RunShardedDecoders(size_t begin, size_t end, const Batch& batch);
+  // Feed the |row| of residual stream, which is the token at |position| of
+  // |sequence|, through the decoder |layer|.
+  void RunDecoder(size_t layer,
+                  int sequence,
+                  size_t position,
+                  size_t row,
+                  Scratch* scratch);
+  // Run the decoders of |stage| for |micro_batch| of pipeline, on the thread
+  // of |stage|.
+  void RunStage(size_t stage, size_t micro_batch);
+  // Compute the logits from the |row| of residual stream.
+  void ComputeLogits(size_t row, std::span<float> logits);
+  // Run the layers for the token at |position| of |sequence|, whose
+  // normalized input is in |scratch|, and add the output to |residual|.
+  void Attention(size_t layer,
+                 int sequence,
+                 size_t position,
+                 std::span<float> residual,
+                 Scratch* scratch);
+  void FeedForward(size_t layer, std::span<float> residual, Scratch* scratch);
+
+  // How many shards the model is split into.
+  size_t ranks() const { return communicator_ ? communicator_->ranks() : 1; }
+
+  std::span<float> residual(size_t row) {
+    size_t dim = shape_.embedding_size;
+    return std::span<float>(residual_).subspan(row * dim, dim);
+  }
+
+  const std::string name_;
+  const ModelShape shape_;
+  const std::unique_ptr<Communicator> communicator_;
+  // The heads and hidden units of this shard, which are all of them without
+  // tensor parallel.
+  const size_t head_dimension_;
+  const size_t heads_;
+  const size_t kv_heads_;
+  const size_t kv_dimension_;
+  const size_t hidden_dim_;
+
+  // The model weights.
+  const float* token_embedding_table_;
+  std::vector<Layer> layers_;
+  std::span<const float> output_norm_;
+  runtime::Matrix classifier_;
+  // The columns of wo and w2 of this shard, which are not contiguous in the
+  // weights.
+  std::vector<std::vector<float>> shard_weights_;
+
+  // Computed keys and values of all layers.
+  KVCache kv_cache_;
+
+  // Buffers of activations, only the residual stream has a row for each token
+  // of a batch. Each micro-batch of pipeline has its own Scratch, as the
+  // stages run them at the same time, and the first one is used otherwise.
+  std::vector<float> residual_;
+  std::vector<Scratch> scratches_;
+  std::vector<float> logits_;
+  // The outputs of attention or feed forward of a shard before all-reduce,
+  // one row for each token.
+  std::vector<float> shard_outputs_;
+  // The outputs of ForwardHidden.
+  std::vector<float> hidden_states_;
+
+  // The outputs of the early exit decoders in self-speculative decoding.
+  std::vector<float> early_exit_;
+  size_t early_exit_layers_ = 0;
+  size_t early_exit_position_ = 0;
+  size_t early_exit_count_ = 0;
+
+  // The micro-batches of running pass, a micro-batch has the tokens of
+  // |batch| in the rows of [micro_rows_[i], micro_rows_[i + 1]).
+  const Batch* pipeline_batch_ = nullptr;
+  size_t pipeline_begin_ = 0;
+  size_t pipeline_end_ = 0;
+  std::array<size_t, kMaxBatchSize + 1> micro_rows_;
+  // Declared last so its threads stop before other members are destroyed.
+  std::unique_ptr<Pipeline> pipeline_;
+};
@@ -0,0 +1,96 @@
+#include "src/sampler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "src/tensor.h"
+
+Sampler::Sampler(unsigned int seed) {
+  Seed(seed);
+}
+
+void Sampler::Seed(unsigned int seed) {
+  if (seed == 0) {
+    std::random_device device;
+    seed = device();
+  }
+  engine_.seed(seed);
+}
+
+int Sampler::SampleTopP(std::span<const float> probabilities, float p) {
+  float total = SortTopP(probabilities, p);
+  const std::vector<std::pair<float, size_t>>& sorted = sorted_;
+
+  // Cumulative distribution function.
+  float r = Uniform() * total;
+  float cdf = 0.f;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    cdf += sorted[i].first;
+    if (r < cdf)
+      return sorted[i].second;
+  }
+  return sorted.back().second;
+}
+
+void Sampler::TruncateTopP(std::span<float> probabilities, float p) {
+  float total = SortTopP(probabilities, p);
+  std::fill(probabilities.begin(), probabilities.end(), 0.f);
+  for (const auto& [probability, index] : sorted_)
+    probabilities[index] = probability / total;
+}
+
+int Sampler::Sample(std::span<const float> weights) {
+  float total = 0.f;
+  for (float weight : weights)
+    total += weight;
+  CHECK_GT(total, 0.f);
+
+  float r = Uniform() * total;
+  float cdf = 0.f;
+  size_t last = 0;
+  for (size_t i = 0; i < weights.size(); i++) {
+    if (weights[i] <= 0.f)
+      continue;
+    cdf += weights[i];
+    if (r < cdf)
+      return i;
+    last = i;
+  }
+  // Rounding errors.
+  return last;
+}
+
+float Sampler::Uniform() {
+  std::uniform_real_distribution<float> uniform_dist(0.f, 1.f);
+  return uniform_dist(engine_);
+}
+
+float Sampler::SortTopP(std::span<const float> probabilities, float p) {
+  size_t n = probabilities.size();
+  CHECK_GT(n, 2);
+  // Ignore the probability if it is less than cutoff.
+  float cutoff = (1.f - p) / (n - 1);
+  // Sort the elements of probabilities into a reused vector.
+  std::vector<std::pair<float, size_t>>& sorted = sorted_;
+  sorted.clear();
+  for (size_t i = 0; i < n; i++) {
+    if (probabilities[i] >= cutoff)
+      sorted.push_back({probabilities[i], i});
+  }
+  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+    return a.first > b.first;
+  });
+  CHECK_GT(sorted.size(), 0);
+
+  // Calculate cumulative probabilities, and drop the elements after the
+  // cumulative probability exceeds p.
+  float total = 0.f;
+  for (size_t i = 0; i < sorted.size(); i++) {
+    total += sorted[i].first;
+    if (total >= p) {
+      sorted.resize(i + 1);
+      break;
+    }
+  }
+  return total;
+}
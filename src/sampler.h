@@ -0,0 +1,40 @@
+#pragma once
+
+#include <random>
+#include <span>
+#include <utility>
+#include <vector>
+
+// Pick the next token from a probability distribution.
+class Sampler {
+ public:
+  // When |seed| is 0 a random seed is used.
+  explicit Sampler(unsigned int seed = 0);
+
+  // Return an index of element using top-p algorithm.
+  int SampleTopP(std::span<const float> probabilities, float p);
+
+  // Set the probabilities outside the ones SampleTopP would pick from to 0,
+  // and re-scale the rest to sum up to 1, so |probabilities| becomes the
+  // actual distribution SampleTopP samples from.
+  void TruncateTopP(std::span<float> probabilities, float p);
+
+  // Return an index of element with probability proportional to its weight,
+  // the |weights| do not have to sum up to 1.
+  int Sample(std::span<const float> weights);
+
+  // Return a random number in [0, 1).
+  float Uniform();
+
+  void Seed(unsigned int seed);
+
+ private:
+  // Sort the elements that top-p algorithm picks from into |sorted_| in
+  // descending order, and return the sum of their probabilities.
+  float SortTopP(std::span<const float> probabilities, float p);
+
+  std::default_random_engine engine_;
+
+  // Reused buffer for sorting probabilities.
+  std::vector<std::pair<float, size_t>> sorted_;
+};
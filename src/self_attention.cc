@@ -1,126 +1,89 @@
 #include "src/self_attention.h"
+#include "src/trace.h"
 
-#include <complex>
-#include <vector>
+#include "models.h"  // generated header
 
 using namespace frost;
 
-namespace {
-
-constexpr
-std::array<float, kLayersSize * kEmbeddingSize * kHeadsSize * kHeadDimension>
-kAttentionQueryWeights = {
-#include "wq.inc"
-};
-
-constexpr
-std::array<float, kLayersSize * kEmbeddingSize * kKVHeadsSize * kHeadDimension>
-kAttentionKeyWeights = {
-#include "wk.inc"
-};
-
-constexpr
-std::array<float, kLayersSize * kEmbeddingSize * kKVHeadsSize * kHeadDimension>
-kAttentionValueWeights = {
-#include "wv.inc"
-};
-
-constexpr
-std::array<float, kLayersSize * kEmbeddingSize * kEmbeddingSize>
-kAttentionOutputWeights = {
-#include "wo.inc"
-};
-
-// Implement RoPE (Rotary Position Embedding) with complex numbers, which
-// essentially transforms the embeddings into points on complex-plane, then use
-// another complex number with magnitue of 1 to rotate it, and convert the
-// points back to embeddings.
-template<template<typename, size_t> typename S, typename T, size_t N>
-void ApplyRotaryEmbeddings(size_t position, TensorBase<S, T, N>* x) {
-  static_assert(N % 2 == 0);
-  for (size_t i = 0; i < N; i += 2) {
-    std::complex<T> sibling((*x)[i], (*x)[i + 1]);
-    float theta = std::pow(10000.f, -1.f * i / kHeadDimension);
-    std::complex<T> frequency = std::polar(1.f, position * theta);
-    std::complex<T> rotated = sibling * frequency;
-    (*x)[i] = rotated.real();
-    (*x)[i + 1] = rotated.imag();
-  }
-}
-
-}  // namespace
-
-SelfAttention::SelfAttention(int layer)
-    : wq_(kAttentionQueryWeights,
-          layer * kEmbeddingSize * kHeadsSize * kHeadDimension),
-      wk_(kAttentionKeyWeights,
-          layer * kEmbeddingSize * kKVHeadsSize * kHeadDimension),
-      wv_(kAttentionValueWeights,
-          layer * kEmbeddingSize * kKVHeadsSize * kHeadDimension),
-      wo_(kAttentionOutputWeights,
-          layer * kEmbeddingSize * kEmbeddingSize) {}
-
-TensorF<kEmbeddingSize> SelfAttention::Forward(TensorF<kEmbeddingSize> x,
-                                               size_t position) {
+template<typename C>
+SelfAttention<C>::SelfAttention(const ModelWeights<C>& weights, int layer)
+    : layer_(layer),
+      wq_(weights.wq[layer]),
+      wk_(weights.wk[layer]),
+      wv_(weights.wv[layer]),
+      wo_(weights.wo[layer]) {}
+
+template<typename C>
+void SelfAttention<C>::Forward(
+    TensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+    const Batch& batch,
+    KVCache* kv_cache,
+    Workspace<C>* workspace,
+    MutableTensorViewF<kMaxBatchSize, C::kEmbeddingSize> residual) const {
+  TRACE_EVENT("SelfAttention");
   // The kHeadsSize is how many heads an attention layer has, the kHeadDimension
   // is the size of partial embedding that a head is responsible for.
-  static_assert(kHeadDimension == kEmbeddingSize / kHeadsSize);
-  // Compute queries for all heads at the |position|.
-  TensorF<kHeadsSize * kHeadDimension> queries = MatrixProduct(wq_, x);
-
-  // In grouped attentions, the keys and values have less heads than queries,
-  static_assert(kHeadsSize % kKVHeadsSize == 0);
-  // Compute keys and values for all heads at the |position| and remember the
-  // results to cache.
-  MutableTensorViewF<kKVHeadsSize * kHeadDimension> keys =
-      keys_cache_[position];
-  MatrixProductTo(wk_, x, &keys);
-  MutableTensorViewF<kKVHeadsSize * kHeadDimension> values =
-      values_cache_[position];
-  MatrixProductTo(wv_, x, &values);
-
-  // Reshape the vectors to multi-dimensional tensors to ease computation.
-  auto xq = queries.ViewAs<kHeadsSize, kHeadDimension>();
-  auto xk = keys_cache_.ViewAs<kSequenceSize, kKVHeadsSize, kHeadDimension>();
-  auto xv = values_cache_.ViewAs<kSequenceSize, kKVHeadsSize, kHeadDimension>();
-
-  // For each query and value at each head, apply RoPE positional encoding.
-  for (size_t i = 0; i < kHeadsSize; ++i) {
-    MutableTensorViewF<kHeadDimension> each = xq[i];
-    ApplyRotaryEmbeddings(position, &each);
-  }
-  for (size_t i = 0; i < kKVHeadsSize; ++i) {
-    MutableTensorViewF<kHeadDimension> each = xk[position][i];
-    ApplyRotaryEmbeddings(position, &each);
+  constexpr size_t kHeadsSize = C::kHeadsSize;
+  constexpr size_t kKVHeadsSize = C::kKVHeadsSize;
+  constexpr size_t kHeadDimension = C::kHeadDimension;
+  size_t count = batch.count;
+  // Compute queries, keys and values for all heads of the tokens. In grouped
+  // attentions, the keys and values have less heads than queries.
+  BatchMatrixProductTo(wq_, x, count, &workspace->queries);
+  BatchMatrixProductTo(wk_, x, count, &workspace->keys);
+  BatchMatrixProductTo(wv_, x, count, &workspace->values);
+
+  for (size_t b = 0; b < count; ++b) {
+    size_t position = batch.positions[b];
+    // Reshape the vectors to multi-dimensional tensors to ease computation.
+    auto xq = workspace->queries[b].template ViewAs<kHeadsSize,
+                                                     kHeadDimension>();
+    auto xk = workspace->keys[b].template ViewAs<kKVHeadsSize,
+                                                  kHeadDimension>();
+    // For each query and key at each head, apply RoPE positional encoding.
+    for (size_t i = 0; i < kHeadsSize; ++i) {
+      MutableTensorViewF<kHeadDimension> each = xq[i];
+      ApplyRotaryEmbeddings(position, &each);
+    }
+    for (size_t i = 0; i < kKVHeadsSize; ++i) {
+      MutableTensorViewF<kHeadDimension> each = xk[i];
+      ApplyRotaryEmbeddings(position, &each);
+    }
+    // Remember the keys and values to cache.
+    auto [keys, values] = kv_cache->Write(layer_, batch.sequences[b],
+                                          position);
+    TensorViewF<C::kKVDimension> computed_keys = workspace->keys[b];
+    std::copy(computed_keys.begin(), computed_keys.end(), keys);
+    TensorViewF<C::kKVDimension> computed_values = workspace->values[b];
+    std::copy(computed_values.begin(), computed_values.end(), values);
   }
 
-  // Compute grouped attention.
-  for (size_t head = 0; head < kHeadsSize; ++head) {
-    TensorViewF<kHeadDimension> query = xq[head];
-
-    // Calculate scores for all positions in this head.
-    std::vector<float> scores(position + 1);
-    for (size_t past = 0; past <= position; ++past) {
+  // Compute grouped attention, each token only sees the tokens before it in
+  // its sequence.
+  for (size_t b = 0; b < count; ++b) {
+    KVCacheView<kKVHeadsSize, kHeadDimension> xk(
+        kv_cache->keys(layer_, batch.sequences[b]));
+    KVCacheView<kKVHeadsSize, kHeadDimension> xv(
+        kv_cache->values(layer_, batch.sequences[b]));
+    auto xq = workspace->queries[b].template ViewAs<kHeadsSize,
+                                                     kHeadDimension>();
+    MutableTensorViewF<C::kEmbeddingSize> attention = workspace->attention[b];
+    for (size_t head = 0; head < kHeadsSize; ++head) {
       // Multiple heads share the same keys/values in grouped attention.
-      size_t key_index = head / (kHeadsSize / kKVHeadsSize);
-      TensorViewF<kHeadDimension> key = xk[past][key_index];
-      scores[past] = DotProduct(query, key) / std::sqrt(kHeadDimension);
-    }
-    // Make the scores sum up to 1.
-    Softmax(scores.begin(), scores.end());
-
-    // Write the weighted value to x.
-    MutableTensorViewF<kHeadDimension> output(x, head * kHeadDimension);
-    std::fill(output.begin(), output.end(), 0);
-    for (size_t past = 0; past <= position; ++past) {
-      size_t value_index = head / (kHeadsSize / kKVHeadsSize);
-      TensorViewF<kHeadDimension> value = xv[past][value_index];
-      float score = scores[past];
-      for (size_t i = 0; i < kHeadDimension; ++i) {
-        output[i] += value[i] * score;
-      }
+      size_t kv_head = head / (kHeadsSize / kKVHeadsSize);
+      // Write the weighted value to the output of this head.
+      MutableTensorViewF<kHeadDimension> output(attention,
+                                                head * kHeadDimension);
+      TensorViewF<kHeadDimension> query = xq[head];
+      AttendHead(query, xk, xv, kv_head, batch.positions[b],
+                 std::span<float>(workspace->scores.begin(), C::kSequenceSize),
+                 output);
     }
   }
 
-  return MatrixProduct(wo_, x);
+  // Project the heads back to embedding and add it to the residual stream.
+  BatchMatrixProductAddTo(wo_, workspace->attention, count, &residual);
 }
+
+#define INSTANTIATE_SELF_ATTENTION(C) template class SelfAttention<C>;
+FROST_FOR_EACH_MODEL(INSTANTIATE_SELF_ATTENTION)
@@ -1,19 +1,30 @@
-#include "src/model_common.h"
+#pragma once
 
+#include "src/kv_cache.h"
+#include "src/model_weights.h"
+#include "src/workspace.h"
+
+template<typename C>
 class SelfAttention {
  public:
-  explicit SelfAttention(int layer);
+  SelfAttention(const ModelWeights<C>& weights, int layer);
 
-  TensorF<kEmbeddingSize> Forward(TensorF<kEmbeddingSize> x, size_t position);
+  // Compute the attention of the tokens of |batch| in |x|, and add the
+  // results to |residual|. The keys and values are remembered in |kv_cache|,
+  // and the temporary tensors are stored in |workspace|.
+  void Forward(TensorViewF<kMaxBatchSize, C::kEmbeddingSize> x,
+               const Batch& batch,
+               KVCache* kv_cache,
+               Workspace<C>* workspace,
+               MutableTensorViewF<kMaxBatchSize, C::kEmbeddingSize> residual)
+      const;
 
  private:
-  // The model weights.
-  const TensorViewF<kEmbeddingSize, kHeadsSize * kHeadDimension> wq_;
-  const TensorViewF<kEmbeddingSize, kKVHeadsSize * kHeadDimension> wk_;
-  const TensorViewF<kEmbeddingSize, kKVHeadsSize * kHeadDimension> wv_;
-  const TensorViewF<kEmbeddingSize, kEmbeddingSize> wo_;
+  const int layer_;
 
-  // Computed keys and values.
-  TensorF<kSequenceSize, kKVHeadsSize * kHeadDimension> keys_cache_;
-  TensorF<kSequenceSize, kKVHeadsSize * kHeadDimension> values_cache_;
+  // The model weights.
+  const TensorViewF<C::kHeadsSize * C::kHeadDimension, C::kEmbeddingSize> wq_;
+  const TensorViewF<C::kKVDimension, C::kEmbeddingSize> wk_;
+  const TensorViewF<C::kKVDimension, C::kEmbeddingSize> wv_;
+  const TensorViewF<C::kEmbeddingSize, C::kEmbeddingSize> wo_;
 };
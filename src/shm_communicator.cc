@@ -0,0 +1,173 @@
+#include "src/shm_communicator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "src/trace.h"
+
+namespace {
+
+// How long to wait for the other ranks to connect.
+constexpr auto kConnectTimeout = std::chrono::seconds(60);
+
+// The header is followed by the slots, each one on its own cache lines.
+constexpr size_t kHeaderSize = 64;
+
+}  // namespace
+
+struct ShmCommunicator::Header {
+  // Set by the rank 0 after initializing the shared memory.
+  std::atomic<uint32_t> ready;
+  uint32_t ranks;
+};
+
+struct ShmCommunicator::Slot {
+  // The generation of last call that wrote the slot.
+  alignas(64) std::atomic<uint64_t> generation;
+  // Set by the rank after connecting.
+  std::atomic<uint32_t> connected;
+  alignas(64) float buffers[2][kChunkSize];
+};
+
+// static
+std::unique_ptr<Communicator> ShmCommunicator::Connect(const char* name,
+                                                       size_t rank,
+                                                       size_t ranks,
+                                                       std::string* error) {
+  static_assert(sizeof(Header) <= kHeaderSize);
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "The atomics must work across processes.");
+#if !defined(_WIN32)
+  std::unique_ptr<ShmCommunicator> communicator(
+      new ShmCommunicator(name, rank, ranks));
+  std::string shm_name = name[0] == '/' ? name : std::string("/") + name;
+  size_t size = kHeaderSize + ranks * sizeof(Slot);
+  auto deadline = std::chrono::steady_clock::now() + kConnectTimeout;
+  if (rank == 0) {
+    // Start from a zeroed object, as the existing one may be left by a
+    // previous run.
+    shm_unlink(shm_name.c_str());
+    int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+      *error = std::string("Failed to create shared memory: ") + name;
+      return nullptr;
+    }
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+      mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      shm_unlink(shm_name.c_str());
+      *error = std::string("Failed to create shared memory: ") + name;
+      return nullptr;
+    }
+    communicator->mapping_ = mapping;
+    communicator->mapping_size_ = size;
+    Header* header = static_cast<Header*>(mapping);
+    header->ranks = ranks;
+    communicator->slot(0)->connected.store(1);
+    header->ready.store(1, std::memory_order_release);
+  } else {
+    // Wait for the rank 0 to create the object.
+    while (!communicator->mapping_) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        *error = std::string("Timed out opening shared memory: ") + name;
+        return nullptr;
+      }
+      void* mapping = MAP_FAILED;
+      int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+      if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size) {
+          mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd, 0);
+        }
+        close(fd);
+      }
+      if (mapping != MAP_FAILED) {
+        Header* header = static_cast<Header*>(mapping);
+        Slot* slot = reinterpret_cast<Slot*>(
+            static_cast<std::byte*>(mapping) + kHeaderSize +
+            rank * sizeof(Slot));
+        // A slot that is already connected belongs to a previous run, and the
+        // rank 0 will replace the object.
+        if (header->ready.load(std::memory_order_acquire) == 1 &&
+            header->ranks == ranks && slot->connected.exchange(1) == 0) {
+          communicator->mapping_ = mapping;
+          communicator->mapping_size_ = size;
+          break;
+        }
+        munmap(mapping, size);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  // Wait for all ranks.
+  for (size_t i = 0; i < ranks; ++i) {
+    while (communicator->slot(i)->connected.load() == 0) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        *error = "Timed out waiting for rank " + std::to_string(i);
+        return nullptr;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  return communicator;
+#else
+  *error = "Shared memory is not supported.";
+  return nullptr;
+#endif
+}
+
+ShmCommunicator::ShmCommunicator(const char* name, size_t rank, size_t ranks)
+    : Communicator(rank, ranks), name_(name) {}
+
+ShmCommunicator::~ShmCommunicator() {
+#if !defined(_WIN32)
+  if (mapping_)
+    munmap(mapping_, mapping_size_);
+  // The other ranks keep their mappings.
+  if (rank() == 0) {
+    std::string shm_name = name_[0] == '/' ? name_ : "/" + name_;
+    shm_unlink(shm_name.c_str());
+  }
+#endif
+}
+
+void ShmCommunicator::AllReduce(std::span<float> data) {
+  TRACE_EVENT("AllReduce");
+  for (size_t offset = 0; offset < data.size(); offset += kChunkSize) {
+    std::span<float> chunk = data.subspan(
+        offset, std::min(kChunkSize, data.size() - offset));
+    uint64_t generation = ++generation_;
+    size_t buffer = generation % 2;
+    Slot* own = slot(rank());
+    std::copy(chunk.begin(), chunk.end(), own->buffers[buffer]);
+    own->generation.store(generation, std::memory_order_release);
+    for (size_t i = 0; i < ranks(); ++i) {
+      while (slot(i)->generation.load(std::memory_order_acquire) < generation)
+        std::this_thread::yield();
+    }
+    // Sum in the order of ranks.
+    std::copy_n(slot(0)->buffers[buffer], chunk.size(), chunk.begin());
+    for (size_t i = 1; i < ranks(); ++i) {
+      const float* other = slot(i)->buffers[buffer];
+      for (size_t j = 0; j < chunk.size(); ++j)
+        chunk[j] += other[j];
+    }
+  }
+}
+
+ShmCommunicator::Slot* ShmCommunicator::slot(size_t rank) const {
+  return reinterpret_cast<Slot*>(static_cast<std::byte*>(mapping_) +
+                                 kHeaderSize + rank * sizeof(Slot));
+}
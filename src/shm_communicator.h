@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "src/communicator.h"
+
+// A Communicator over a POSIX shared memory object, for the ranks running on
+// one host.
+//
+// Each rank has a slot of two buffers in the shared memory, which are used in
+// turns like a ring buffer. To all-reduce, a rank writes its data to its next
+// buffer and publishes the generation of the call, then waits for the other
+// ranks to publish the same generation and sums their buffers. A rank only
+// overwrites a buffer after all ranks published the call after the one using
+// it, which they do after reading the buffer. The ranks wait by spinning, as
+// the calls are at most a few microseconds apart.
+class ShmCommunicator : public Communicator {
+ public:
+  // Floats of a buffer, larger data are all-reduced in chunks.
+  static constexpr size_t kChunkSize = 64 * 1024;
+
+  // The rank 0 creates the shared memory object |name|, which is replaced if
+  // it exists, and the other ranks open it. Return nullptr and write the
+  // reason to |error| on failure, or if not all ranks connected in time.
+  static std::unique_ptr<Communicator> Connect(const char* name,
+                                               size_t rank,
+                                               size_t ranks,
+                                               std::string* error);
+
+  ~ShmCommunicator() override;
+
+  // Communicator:
+  void AllReduce(std::span<float> data) override;
+
+ private:
+  struct Header;
+  struct Slot;
+
+  ShmCommunicator(const char* name, size_t rank, size_t ranks);
+
+  Slot* slot(size_t rank) const;
+
+  const std::string name_;
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  // How many chunks have been all-reduced.
+  uint64_t generation_ = 0;
+};
@@ -5,6 +5,8 @@
 #include <span>
 #include <utility>
 
+#include "src/profiler.h"
+
 // Runtime checks.
 #if !defined(CHECK)
 #define UNLIKELY(expr) __builtin_expect(!!(expr), 0)
@@ -214,6 +216,19 @@ class TensorBase {
   S<T, storage_size> data_;
 };
 
+// Compute dot product of 2 vectors with same length.
+template<template<typename, size_t> typename S1,
+         template<typename, size_t> typename S2,
+         typename T1, typename T2, size_t N>
+constexpr auto DotProduct(const TensorBase<S1, T1, N>& left,
+                        const TensorBase<S2, T2, N>& right) {
+  using T = std::remove_const_t<T1>;
+  T result = T();
+  for (size_t i = 0; i < N; ++i)
+    result += left[i] * right[i];
+  return result;
+}
+
 // Compute product of NxM matrix and M vector.
 template<template<typename, size_t> typename S1,
          template<typename, size_t> typename S2,
@@ -234,25 +249,65 @@ template<template<typename, size_t> typename S1,
 void MatrixProductTo(const TensorBase<S1, T1, N, M>& left,
                      const TensorBase<S2, T2, M>& right,
                      TensorBase<S3, T3, N>* out) {
+  PROFILE_OP(kMatrixProduct, sizeof(T1) * (N * M + M + N));
+  for (size_t i = 0; i < N; ++i)
+    (*out)[i] = DotProduct(left[i], right);
+}
+
+// Compute product of NxM matrix and M vector, and add the result to |out|.
+// This saves a pass over the output compared to adding after the product.
+template<template<typename, size_t> typename S1,
+         template<typename, size_t> typename S2,
+         template<typename, size_t> typename S3,
+         typename T1, typename T2, typename T3,
+         size_t N, size_t M>
+void MatrixProductAddTo(const TensorBase<S1, T1, N, M>& left,
+                        const TensorBase<S2, T2, M>& right,
+                        TensorBase<S3, T3, N>* out) {
+  PROFILE_OP(kMatrixProduct, sizeof(T1) * (N * M + M + N));
+  for (size_t i = 0; i < N; ++i)
+    (*out)[i] += DotProduct(left[i], right);
+}
+
+// Compute products of NxM matrix and the first |count| M vectors of |right|.
+// Each row of the matrix is read once for all vectors, so the cost of reading
+// the matrix from memory is shared by all vectors.
+template<template<typename, size_t> typename S1,
+         template<typename, size_t> typename S2,
+         template<typename, size_t> typename S3,
+         typename T1, typename T2, typename T3,
+         size_t B, size_t N, size_t M>
+void BatchMatrixProductTo(const TensorBase<S1, T1, N, M>& left,
+                          const TensorBase<S2, T2, B, M>& right,
+                          size_t count,
+                          TensorBase<S3, T3, B, N>* out) {
+  PROFILE_OP(kMatrixProduct, sizeof(T1) * (N * M + count * (M + N)));
+  CHECK_LE(count, B);
   for (size_t i = 0; i < N; ++i) {
-    (*out)[i] = 0;
-    for (size_t j = 0; j < M; ++j) {
-      (*out)[i] += left[i][j] * right[j];
-    }
+    auto row = left[i];
+    for (size_t b = 0; b < count; ++b)
+      (*out)[b][i] = DotProduct(row, right[b]);
   }
 }
 
-// Compute dot product of 2 vectors with same length.
+// Compute products of NxM matrix and the first |count| M vectors of |right|,
+// and add the results to |out|.
 template<template<typename, size_t> typename S1,
          template<typename, size_t> typename S2,
-         typename T1, typename T2, size_t N>
-constexpr auto DotProduct(const TensorBase<S1, T1, N>& left,
-                        const TensorBase<S2, T2, N>& right) {
-  using T = std::remove_const_t<T1>;
-  T result = T();
-  for (size_t i = 0; i < N; ++i)
-    result += left[i] * right[i];
-  return result;
+         template<typename, size_t> typename S3,
+         typename T1, typename T2, typename T3,
+         size_t B, size_t N, size_t M>
+void BatchMatrixProductAddTo(const TensorBase<S1, T1, N, M>& left,
+                             const TensorBase<S2, T2, B, M>& right,
+                             size_t count,
+                             TensorBase<S3, T3, B, N>* out) {
+  PROFILE_OP(kMatrixProduct, sizeof(T1) * (N * M + count * (M + N)));
+  CHECK_LE(count, B);
+  for (size_t i = 0; i < N; ++i) {
+    auto row = left[i];
+    for (size_t b = 0; b < count; ++b)
+      (*out)[b][i] += DotProduct(row, right[b]);
+  }
 }
 
 }  // namespace frost
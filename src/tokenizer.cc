@@ -0,0 +1,209 @@
+#include "src/tokenizer.h"
+
+#include <cstring>
+#include <queue>
+
+#include "src/tensor.h"
+
+namespace {
+
+// The FNV-1a hash.
+size_t Hash(std::string_view str) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : str) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Read a value from the unaligned bytes and advance.
+template<typename T>
+bool ReadValue(std::span<const std::byte>* data, T* out) {
+  if (data->size() < sizeof(T))
+    return false;
+  memcpy(out, data->data(), sizeof(T));
+  *data = data->subspan(sizeof(T));
+  return true;
+}
+
+// A symbol is a range of the text that would become a token.
+struct Symbol {
+  size_t begin;
+  size_t size;
+  int id;
+  // Neighbors in the linked list, -1 means none.
+  int prev;
+  int next;
+};
+
+// A candidate of merging 2 adjacent symbols.
+struct Merge {
+  float score;
+  int left;
+  int right;
+  // Size of the merged piece, used to check whether the symbols have been
+  // changed since the merge was queued.
+  size_t size;
+  int id;
+};
+
+// The merge with highest score comes first, and the left one wins if scores
+// are equal, which is the same with SentencePiece.
+struct MergeOrder {
+  bool operator()(const Merge& a, const Merge& b) const {
+    return a.score < b.score || (a.score == b.score && a.left > b.left);
+  }
+};
+
+}  // namespace
+
+// static
+std::unique_ptr<Tokenizer> Tokenizer::Load(const char* path,
+                                           size_t vocab_size,
+                                           std::string* error) {
+  std::unique_ptr<Tokenizer> tokenizer(new Tokenizer);
+  tokenizer->file_ = MappedFile::Open(path);
+  if (!tokenizer->file_) {
+    *error = std::string("Failed to open tokenizer: ") + path;
+    return nullptr;
+  }
+
+  // The file starts with the max length of pieces, followed by the score,
+  // size and text of each piece.
+  std::span<const std::byte> data = tokenizer->file_->data();
+  int max_token_length;
+  if (!ReadValue(&data, &max_token_length)) {
+    *error = "Invalid tokenizer file.";
+    return nullptr;
+  }
+  tokenizer->pieces_.reserve(vocab_size);
+  tokenizer->scores_.reserve(vocab_size);
+  for (size_t i = 0; i < vocab_size; ++i) {
+    float score;
+    int length;
+    if (!ReadValue(&data, &score) || !ReadValue(&data, &length) ||
+        length < 0 || data.size() < static_cast<size_t>(length)) {
+      *error = "The tokenizer does not match the model.";
+      return nullptr;
+    }
+    tokenizer->pieces_.emplace_back(
+        reinterpret_cast<const char*>(data.data()), length);
+    tokenizer->scores_.push_back(score);
+    data = data.subspan(length);
+  }
+
+  // Build the hash table with a load factor below 0.5.
+  size_t capacity = 1;
+  while (capacity < vocab_size * 2)
+    capacity *= 2;
+  tokenizer->slots_.resize(capacity, -1);
+  tokenizer->slots_mask_ = capacity - 1;
+  for (size_t id = 0; id < vocab_size; ++id) {
+    std::string_view piece = tokenizer->pieces_[id];
+    size_t slot = Hash(piece) & tokenizer->slots_mask_;
+    while (tokenizer->slots_[slot] >= 0) {
+      // Keep the first one for duplicate pieces.
+      if (tokenizer->pieces_[tokenizer->slots_[slot]] == piece)
+        break;
+      slot = (slot + 1) & tokenizer->slots_mask_;
+    }
+    if (tokenizer->slots_[slot] < 0)
+      tokenizer->slots_[slot] = id;
+  }
+  return tokenizer;
+}
+
+Tokenizer::~Tokenizer() = default;
+
+int Tokenizer::Find(std::string_view piece) const {
+  size_t slot = Hash(piece) & slots_mask_;
+  while (slots_[slot] >= 0) {
+    if (pieces_[slots_[slot]] == piece)
+      return slots_[slot];
+    slot = (slot + 1) & slots_mask_;
+  }
+  return -1;
+}
+
+void Tokenizer::Encode(std::string_view input, bool add_bos,
+                       std::vector<int>* tokens) const {
+  if (add_bos)
+    tokens->push_back(kBosId);
+  if (input.empty())
+    return;
+
+  // SentencePiece adds a space before the text, and the space symbol has been
+  // replaced with space in tokenizer.bin, so no other normalization is needed.
+  std::string text;
+  text.reserve(input.size() + 1);
+  text += ' ';
+  text += input;
+
+  // Split the text into UTF-8 characters, and fallback to bytes for unknown
+  // characters.
+  std::vector<Symbol> symbols;
+  symbols.reserve(text.size());
+  for (size_t i = 0; i < text.size();) {
+    size_t size = 1;
+    while (i + size < text.size() && size < 4 &&
+           (text[i + size] & 0xC0) == 0x80) {
+      size++;
+    }
+    int id = Find(std::string_view(text).substr(i, size));
+    if (id >= 0) {
+      symbols.push_back({i, size, id, -1, -1});
+    } else {
+      // A byte token does not match the text so it will never be merged.
+      for (size_t j = 0; j < size; ++j) {
+        int byte = static_cast<unsigned char>(text[i + j]);
+        symbols.push_back({i + j, 1, kFirstByteId + byte, -1, -1});
+      }
+    }
+    i += size;
+  }
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    symbols[i].prev = static_cast<int>(i) - 1;
+    symbols[i].next = i + 1 < symbols.size() ? i + 1 : -1;
+  }
+
+  // Queue the merge of symbols at |left| and |right| if the merged piece is in
+  // vocabulary.
+  std::priority_queue<Merge, std::vector<Merge>, MergeOrder> queue;
+  auto try_merge = [&](int left, int right) {
+    if (left < 0 || right < 0 ||
+        IsByte(symbols[left].id) || IsByte(symbols[right].id)) {
+      return;
+    }
+    size_t size = symbols[left].size + symbols[right].size;
+    int id = Find(std::string_view(text).substr(symbols[left].begin, size));
+    if (id >= 0)
+      queue.push({scores_[id], left, right, size, id});
+  };
+  for (size_t i = 1; i < symbols.size(); ++i)
+    try_merge(i - 1, i);
+
+  // Keep merging the pair with highest score.
+  while (!queue.empty()) {
+    Merge merge = queue.top();
+    queue.pop();
+    Symbol& left = symbols[merge.left];
+    Symbol& right = symbols[merge.right];
+    // Skip if any of the symbols has been merged into others.
+    if (left.size == 0 || right.size == 0 ||
+        left.size + right.size != merge.size) {
+      continue;
+    }
+    left.size = merge.size;
+    left.id = merge.id;
+    left.next = right.next;
+    if (right.next >= 0)
+      symbols[right.next].prev = merge.left;
+    right.size = 0;
+    try_merge(left.prev, merge.left);
+    try_merge(merge.left, left.next);
+  }
+
+  for (int i = 0; i >= 0; i = symbols[i].next)
+    tokens->push_back(symbols[i].id);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "src/mapped_file.h"
+
+// A BPE tokenizer reading the vocabulary from the tokenizer.bin file of
+// llama2.c, which produces the same tokens with the SentencePiece model that
+// the file was exported from.
+class Tokenizer {
+ public:
+  // Load the vocabulary of |vocab_size| pieces from |path|, return nullptr and
+  // write the reason to |error| on failure.
+  static std::unique_ptr<Tokenizer> Load(const char* path,
+                                         size_t vocab_size,
+                                         std::string* error);
+
+  ~Tokenizer();
+
+  Tokenizer(const Tokenizer&) = delete;
+  Tokenizer& operator=(const Tokenizer&) = delete;
+
+  // Convert |text| to tokens and append them to |tokens|.
+  void Encode(std::string_view text, bool add_bos,
+              std::vector<int>* tokens) const;
+
+  // Return the id of |piece|, or -1 if not in vocabulary.
+  int Find(std::string_view piece) const;
+
+  // The text of a piece as stored in tokenizer.bin, in which the space symbol
+  // of SentencePiece has been replaced with space.
+  std::string_view Piece(int id) const { return pieces_[id]; }
+
+  // Whether the token represents a raw byte, i.e. <0x0A>.
+  bool IsByte(int id) const {
+    return id >= kFirstByteId && id < kFirstByteId + 256;
+  }
+
+  size_t size() const { return pieces_.size(); }
+
+  static constexpr int kUnknownId = 0;
+  static constexpr int kBosId = 1;
+  static constexpr int kEosId = 2;
+  static constexpr int kFirstByteId = 3;
+
+ private:
+  Tokenizer() = default;
+
+  std::unique_ptr<MappedFile> file_;
+
+  // Views into the mapped file.
+  std::vector<std::string_view> pieces_;
+  std::vector<float> scores_;
+
+  // Open addressing hash table mapping pieces to ids, an empty slot is -1.
+  std::vector<int> slots_;
+  size_t slots_mask_ = 0;
+};
@@ -0,0 +1,132 @@
+#include "src/trace.h"
+
+#if defined(FROST_ENABLE_TRACING)
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+  const char* name;
+  int layer;
+  int64_t start;
+  int64_t duration;
+};
+
+struct ThreadBuffer {
+  int tid;
+  std::vector<Event> events;
+};
+
+struct State {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+  std::string path;
+  Clock::time_point origin;
+  std::atomic<bool> recording = false;
+};
+
+State& GetState() {
+  static State state;
+  return state;
+}
+
+thread_local ThreadBuffer* current_buffer = nullptr;
+
+int64_t Now() {
+  return std::chrono::nanoseconds(Clock::now() - GetState().origin).count();
+}
+
+ThreadBuffer* GetThreadBuffer() {
+  if (!current_buffer) {
+    State& state = GetState();
+    std::lock_guard lock(state.mutex);
+    state.buffers.push_back(std::make_unique<ThreadBuffer>());
+    current_buffer = state.buffers.back().get();
+    current_buffer->tid = state.buffers.size();
+  }
+  return current_buffer;
+}
+
+}  // namespace
+
+bool Start(const char* path) {
+  State& state = GetState();
+  std::lock_guard lock(state.mutex);
+  state.path = path;
+  state.origin = Clock::now();
+  for (auto& buffer : state.buffers)
+    buffer->events.clear();
+  state.recording = true;
+  return true;
+}
+
+bool Stop() {
+  State& state = GetState();
+  state.recording = false;
+  std::lock_guard lock(state.mutex);
+  FILE* file = fopen(state.path.c_str(), "w");
+  if (!file)
+    return false;
+  fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  bool first = true;
+  for (const auto& buffer : state.buffers) {
+    fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                  "\"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+            first ? "" : ",\n", buffer->tid, buffer->tid);
+    first = false;
+    for (const Event& event : buffer->events) {
+      // Chrome trace uses microseconds.
+      fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                    "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+              event.name, buffer->tid, event.start / 1e3,
+              event.duration / 1e3);
+      if (event.layer >= 0)
+        fprintf(file, ", \"args\": {\"layer\": %d}", event.layer);
+      fprintf(file, "}");
+    }
+    buffer->events.clear();
+  }
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  return true;
+}
+
+ScopedEvent::ScopedEvent(const char* name, int layer)
+    : name_(name),
+      layer_(layer),
+      start_(GetState().recording ? Now() : -1) {}
+
+ScopedEvent::~ScopedEvent() {
+  if (start_ < 0 || !GetState().recording)
+    return;
+  GetThreadBuffer()->events.push_back({name_, layer_, start_, Now() - start_});
+}
+
+}  // namespace trace
+
+#else
+
+namespace trace {
+
+bool Start(const char* path) {
+  return false;
+}
+
+bool Stop() {
+  return false;
+}
+
+}  // namespace trace
+
+#endif  // defined(FROST_ENABLE_TRACING)
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+// Record a timeline of events in the Chrome trace format, which can be opened
+// with Perfetto (https://ui.perfetto.dev) or chrome://tracing.
+//
+// The events are compiled in when FROST_ENABLE_TRACING is defined (the
+// frost_enable_tracing GN arg), and are only recorded between Start() and
+// Stop(). Each thread records to its own buffer.
+//
+// Usage:
+//   TRACE_EVENT("Transformer::Forward");  // record the rest of scope
+
+namespace trace {
+
+// Start recording events, return false if tracing is not compiled in.
+bool Start(const char* path);
+
+// Stop recording and write the events to the file passed to Start(), other
+// threads should not be recording events when calling this.
+bool Stop();
+
+// Record the scope of this class as an event, with an optional |layer| arg.
+class ScopedEvent {
+ public:
+  explicit ScopedEvent(const char* name, int layer = -1);
+  ~ScopedEvent();
+
+  ScopedEvent(const ScopedEvent&) = delete;
+  ScopedEvent& operator=(const ScopedEvent&) = delete;
+
+ private:
+  const char* name_;
+  int layer_;
+  // Nanoseconds since the start of tracing, or -1 when not recording.
+  int64_t start_;
+};
+
+}  // namespace trace
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#if defined(FROST_ENABLE_TRACING)
+#define TRACE_EVENT(name) \
+  trace::ScopedEvent TRACE_CONCAT(trace_event_, __LINE__)(name)
+#else
+#define TRACE_EVENT(name) do {} while (0)
+#endif
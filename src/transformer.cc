@@ -1,35 +1,251 @@
+#include <algorithm>
+
 #include "src/embedding.h"
+#include "src/trace.h"
 #include "src/transformer.h"
 
-namespace {
+#include "models.h"  // generated header
 
-// The weights are stored as std::array literal.
-// Note that though it is very tempting to store the weights as Tensor directly,
-// doing so would crash clang.
-constexpr std::array<float, kEmbeddingSize> kNormOutWeights = {
-#include "rms_out_weight.inc"
-};
+namespace {
 
 // Helper to constructor decoders with layer numbers, i.e.
-// return std::array<Decoder, 3>{Decoder(0), Decoder(1), Decoder(2)};
-template<size_t... N>
-constexpr auto MakeDecoders(std::index_sequence<N...>) {
-  return std::array<Decoder, sizeof...(N)>{Decoder(N)...};
+// return std::array<Decoder<C>, 3>{Decoder<C>(weights, 0), ...};
+template<typename C, size_t... N>
+auto MakeDecoders(const ModelWeights<C>& weights, std::index_sequence<N...>) {
+  return std::array<Decoder<C>, sizeof...(N)>{Decoder<C>(weights, N)...};
 }
 
 }  // namespace
 
-Transformer::Transformer()
-    : decoders_(MakeDecoders(std::make_index_sequence<kLayersSize>())),
-      norm_weights_(kNormOutWeights) {}
+template<typename C>
+Transformer<C>::Transformer(
+    std::span<const float, C::kWeightsSize> weights,
+    std::span<const float, C::kClassifierSize> classifier)
+    : weights_(weights, classifier),
+      decoders_(MakeDecoders(weights_,
+                             std::make_index_sequence<C::kLayersSize>())),
+      workspace_(std::make_unique<Workspace<C>>()),
+      kv_cache_(C::kLayersSize, C::kKVDimension, C::kSequenceSize) {}
+
+template<typename C>
+Transformer<C>::~Transformer() = default;
+
+template<typename C>
+std::span<float> Transformer<C>::Forward(std::span<const int> tokens,
+                                         std::span<const int> sequences,
+                                         std::span<const size_t> positions) {
+  TRACE_EVENT("Transformer::Forward");
+  return ComputeLogits(RunTokens(tokens, sequences, positions));
+}
+
+template<typename C>
+std::span<float> Transformer<C>::ForwardHidden(
+    std::span<const int> tokens,
+    std::span<const int> sequences,
+    std::span<const size_t> positions) {
+  TRACE_EVENT("Transformer::ForwardHidden");
+  size_t count = RunTokens(tokens, sequences, positions);
+  NormalizeOutput(count);
+  auto hidden = workspace_->normalized.template ViewAs<kMaxBatchSize *
+                                                       C::kEmbeddingSize>();
+  return std::span<float>(hidden.begin(), count * C::kEmbeddingSize);
+}
+
+template<typename C>
+void Transformer<C>::Fork(int parent, int child, size_t size) {
+  kv_cache_.Fork(parent, child, size);
+}
+
+template<typename C>
+void Transformer<C>::Release(int sequence) {
+  kv_cache_.Release(sequence);
+}
+
+template<typename C>
+size_t Transformer<C>::RunTokens(std::span<const int> tokens,
+                                 std::span<const int> sequences,
+                                 std::span<const size_t> positions) {
+  Batch batch;
+  batch.count = tokens.size();
+  CHECK(batch.count > 0 && batch.count <= kMaxBatchSize);
+  CHECK(sequences.size() == batch.count && positions.size() == batch.count);
+  Workspace<C>* workspace = workspace_.get();
+  for (size_t b = 0; b < batch.count; ++b) {
+    CHECK_LT(positions[b], C::kSequenceSize);
+    batch.sequences[b] = sequences[b];
+    batch.positions[b] = positions[b];
+    // Encode the tokens into embeddings.
+    Encode(weights_, tokens[b], workspace->residual[b]);
+  }
+  // Feed the embeddings through encoder blocks.
+  RunDecoders(0, C::kLayersSize, batch);
+  return batch.count;
+}
+
+template<typename C>
+void Transformer<C>::FeedEarlyExit(int token, size_t position, size_t layers) {
+  TRACE_EVENT("Transformer::FeedEarlyExit");
+  CHECK(layers > 0 && layers < C::kLayersSize);
+  CHECK_LT(position, C::kSequenceSize);
+  if (early_exit_count_ == 0) {
+    early_exit_layers_ = layers;
+    early_exit_position_ = position;
+  }
+  CHECK_EQ(layers, early_exit_layers_);
+  CHECK_EQ(position, early_exit_position_ + early_exit_count_);
+  CHECK_LT(early_exit_count_, kMaxBatchSize);
+  Workspace<C>* workspace = workspace_.get();
+  Encode(weights_, token, workspace->residual[0]);
+  Batch batch;
+  batch.count = 1;
+  batch.sequences[0] = 0;
+  batch.positions[0] = position;
+  RunDecoders(0, layers, batch);
+  // Remember the output so the rest decoders can continue from it.
+  TensorViewF<C::kEmbeddingSize> output = workspace->residual[0];
+  std::copy(output.begin(), output.end(),
+            workspace->early_exit[early_exit_count_++].begin());
+}
 
-TensorF<kTokensSize> Transformer::Forward(TensorF<kEmbeddingSize> x,
-                                          size_t position) {
-  // Feed the embedding through encoder blocks.
-  for (size_t i = 0; i < kLayersSize; ++i)
-    x = decoders_[i].Forward(x, position);
-  // Normalize the result and convert it to logits, which is a vector with each
-  // element representing how likely its index might be the next token.
-  x = RMSNormalize(x.View(), norm_weights_);
-  return EmbeddingToTokenLogits(x);
+template<typename C>
+std::span<float> Transformer<C>::EarlyExitLogits() {
+  CHECK_GT(early_exit_count_, 0);
+  // The first row of residual stream still has the output of last token.
+  return ComputeLogits(1);
 }
+
+template<typename C>
+std::span<float> Transformer<C>::FinishEarlyExit() {
+  TRACE_EVENT("Transformer::FinishEarlyExit");
+  size_t count = early_exit_count_;
+  CHECK_GT(count, 0);
+  Workspace<C>* workspace = workspace_.get();
+  Batch batch;
+  batch.count = count;
+  for (size_t b = 0; b < count; ++b) {
+    batch.sequences[b] = 0;
+    batch.positions[b] = early_exit_position_ + b;
+    TensorViewF<C::kEmbeddingSize> output = workspace->early_exit[b];
+    std::copy(output.begin(), output.end(), workspace->residual[b].begin());
+  }
+  RunDecoders(early_exit_layers_, C::kLayersSize, batch);
+  early_exit_count_ = 0;
+  return ComputeLogits(count);
+}
+
+template<typename C>
+void Transformer<C>::EnablePipeline(size_t stages,
+                                    std::span<const int> cpus) {
+  stages = std::clamp<size_t>(stages, 1, std::min(C::kLayersSize,
+                                                  kMaxBatchSize));
+  pipeline_.reset();
+  micro_workspaces_.clear();
+  if (stages == 1)
+    return;
+  // The workspaces are allocated by the stages, which first touch them.
+  micro_workspaces_.resize(stages);
+  pipeline_ = std::make_unique<Pipeline>(
+      stages,
+      [this](size_t stage, size_t micro_batch) {
+        RunStage(stage, micro_batch);
+      },
+      [this](size_t stage) {
+        micro_workspaces_[stage] = std::make_unique<Workspace<C>>();
+      },
+      cpus);
+}
+
+template<typename C>
+void Transformer<C>::RunDecoders(size_t begin,
+                                 size_t end,
+                                 const Batch& batch) {
+  if (pipeline_ && batch.count > 1 && !layer_streaming()) {
+    RunPipeline(begin, end, batch);
+    return;
+  }
+  Workspace<C>* workspace = workspace_.get();
+  for (size_t i = begin; i < end; ++i) {
+    BeginLayer(i);
+    decoders_[i].Forward(workspace->residual, batch, &kv_cache_, workspace);
+    EndLayer(i);
+  }
+}
+
+template<typename C>
+void Transformer<C>::RunPipeline(size_t begin,
+                                 size_t end,
+                                 const Batch& batch) {
+  TRACE_EVENT("Transformer::RunPipeline");
+  // The stages write the KV cache of different layers at the same time.
+  kv_cache_.Reserve(begin, end, batch);
+  // Split the rows into contiguous micro-batches, so the tokens of a
+  // sequence are still fed in order.
+  Workspace<C>* workspace = workspace_.get();
+  size_t count = std::min(batch.count, pipeline_->stages());
+  for (size_t m = 0; m < count; ++m) {
+    size_t first = m * batch.count / count;
+    Batch& micro_batch = micro_batches_[m];
+    micro_batch.count = (m + 1) * batch.count / count - first;
+    for (size_t b = 0; b < micro_batch.count; ++b) {
+      micro_batch.sequences[b] = batch.sequences[first + b];
+      micro_batch.positions[b] = batch.positions[first + b];
+      TensorViewF<C::kEmbeddingSize> row = workspace->residual[first + b];
+      std::copy(row.begin(), row.end(),
+                micro_workspaces_[m]->residual[b].begin());
+    }
+  }
+  pipeline_begin_ = begin;
+  pipeline_end_ = end;
+  pipeline_->Run(count);
+  for (size_t m = 0; m < count; ++m) {
+    size_t first = m * batch.count / count;
+    for (size_t b = 0; b < micro_batches_[m].count; ++b) {
+      TensorViewF<C::kEmbeddingSize> row = micro_workspaces_[m]->residual[b];
+      std::copy(row.begin(), row.end(),
+                workspace->residual[first + b].begin());
+    }
+  }
+}
+
+template<typename C>
+void Transformer<C>::RunStage(size_t stage, size_t micro_batch) {
+  size_t stages = pipeline_->stages();
+  size_t begin = std::max(pipeline_begin_, stage * C::kLayersSize / stages);
+  size_t end = std::min(pipeline_end_,
+                        (stage + 1) * C::kLayersSize / stages);
+  Workspace<C>* workspace = micro_workspaces_[micro_batch].get();
+  for (size_t i = begin; i < end; ++i) {
+    decoders_[i].Forward(workspace->residual, micro_batches_[micro_batch],
+                         &kv_cache_, workspace);
+  }
+}
+
+template<typename C>
+void Transformer<C>::NormalizeOutput(size_t count) {
+  Workspace<C>* workspace = workspace_.get();
+  for (size_t b = 0; b < count; ++b) {
+    MutableTensorViewF<C::kEmbeddingSize> normalized = workspace->normalized[b];
+    RMSNormalize(workspace->residual[b], weights_.output_norm, &normalized);
+  }
+}
+
+template<typename C>
+std::span<float> Transformer<C>::ComputeLogits(size_t count) {
+  Workspace<C>* workspace = workspace_.get();
+  // Normalize the results and convert them to logits, which are vectors with
+  // each element representing how likely its index might be the next token.
+  NormalizeOutput(count);
+  if (allowed_tokens().empty()) {
+    EmbeddingToTokenLogits(weights_, workspace->normalized, count,
+                           &workspace->logits);
+  } else {
+    EmbeddingToTokenLogits(weights_, workspace->normalized, count,
+                           allowed_tokens(), &workspace->logits);
+  }
+  auto logits = workspace->logits.template ViewAs<kMaxBatchSize *
+                                                  C::kTokensSize>();
+  return std::span<float>(logits.begin(), count * C::kTokensSize);
+}
+
+#define INSTANTIATE_TRANSFORMER(C) template class Transformer<C>;
+FROST_FOR_EACH_MODEL(INSTANTIATE_TRANSFORMER)
@@ -1,15 +1,81 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
 #include "src/decoder.h"
+#include "src/language_model.h"
+#include "src/pipeline.h"
 
-class Transformer {
+template<typename C>
+class Transformer : public LanguageModel {
  public:
-  Transformer();
+  // The |classifier| is the token embedding table in |weights| when the model
+  // shares them.
+  Transformer(std::span<const float, C::kWeightsSize> weights,
+              std::span<const float, C::kClassifierSize> classifier);
+  ~Transformer() override;
 
-  TensorF<kTokensSize> Forward(TensorF<kEmbeddingSize> x, size_t position);
+  // LanguageModel:
+  const char* name() const override { return C::kName; }
+  const ModelShape& shape() const override { return C::kShape; }
+  std::span<float> Forward(std::span<const int> tokens,
+                           std::span<const int> sequences,
+                           std::span<const size_t> positions) override;
+  using LanguageModel::Forward;
+  std::span<float> ForwardHidden(std::span<const int> tokens,
+                                 std::span<const int> sequences,
+                                 std::span<const size_t> positions) override;
+  void Fork(int parent, int child, size_t size) override;
+  void Release(int sequence) override;
+  void FeedEarlyExit(int token, size_t position, size_t layers) override;
+  std::span<float> EarlyExitLogits() override;
+  std::span<float> FinishEarlyExit() override;
+  void EnablePipeline(size_t stages, std::span<const int> cpus) override;
 
  private:
-  // The model layers.
-  std::array<Decoder, kLayersSize> decoders_;
+  // Encode |tokens| into the residual stream and feed them through all the
+  // decoders, return how many tokens there are.
+  size_t RunTokens(std::span<const int> tokens,
+                   std::span<const int> sequences,
+                   std::span<const size_t> positions);
+  // Feed the rows of residual stream for |batch| through the decoders in
+  // [begin, end).
+  void RunDecoders(size_t begin, size_t end, const Batch& batch);
+  // Same with RunDecoders but run the micro-batches of |batch| through the
+  // stages of pipeline.
+  void RunPipeline(size_t begin, size_t end, const Batch& batch);
+  // Run the decoders of |stage| for |micro_batch|, on the thread of |stage|.
+  void RunStage(size_t stage, size_t micro_batch);
+  // Normalize the first |count| rows of residual stream.
+  void NormalizeOutput(size_t count);
+  // Compute the logits from the first |count| rows of residual stream.
+  std::span<float> ComputeLogits(size_t count);
 
   // The model weights.
-  const TensorViewF<kEmbeddingSize> norm_weights_;
+  const ModelWeights<C> weights_;
+
+  // The model layers.
+  std::array<Decoder<C>, C::kLayersSize> decoders_;
+
+  // Buffers of activations.
+  std::unique_ptr<Workspace<C>> workspace_;
+
+  // Computed keys and values of all layers.
+  KVCache kv_cache_;
+
+  // Each micro-batch of pipeline has its own rows of residual stream and
+  // buffers in a workspace, as the stages run them at the same time.
+  std::vector<std::unique_ptr<Workspace<C>>> micro_workspaces_;
+  std::array<Batch, kMaxBatchSize> micro_batches_;
+  // The decoders of running pass.
+  size_t pipeline_begin_ = 0;
+  size_t pipeline_end_ = 0;
+  // Declared last so its threads stop before other members are destroyed.
+  std::unique_ptr<Pipeline> pipeline_;
+
+  // The tokens passed to FeedEarlyExit.
+  size_t early_exit_layers_ = 0;
+  size_t early_exit_position_ = 0;
+  size_t early_exit_count_ = 0;
 };
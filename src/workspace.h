@@ -0,0 +1,38 @@
+#pragma once
+
+#include "src/model_common.h"
+
+// Buffers for the activations of a forward pass.
+//
+// The buffers are allocated once with the model, and layers write their
+// results into them instead of returning temporary tensors, so a forward pass
+// neither copies tensors around nor allocates memory. Each buffer is aligned
+// to cache line.
+//
+// Each buffer has a row for each token in a batch, while only the first rows
+// are used when there are less tokens in the batch.
+template<typename C>
+struct Workspace {
+  // The residual stream, which is updated by the decoders in place.
+  alignas(64) TensorF<kMaxBatchSize, C::kEmbeddingSize> residual;
+
+  // The normalized input of attention and feed forward layers.
+  alignas(64) TensorF<kMaxBatchSize, C::kEmbeddingSize> normalized;
+
+  // Attention layer.
+  alignas(64) TensorF<kMaxBatchSize, C::kHeadsSize * C::kHeadDimension> queries;
+  alignas(64) TensorF<kMaxBatchSize, C::kKVDimension> keys;
+  alignas(64) TensorF<kMaxBatchSize, C::kKVDimension> values;
+  alignas(64) TensorF<C::kSequenceSize> scores;
+  alignas(64) TensorF<kMaxBatchSize, C::kEmbeddingSize> attention;
+
+  // Feed forward layer.
+  alignas(64) TensorF<kMaxBatchSize, C::kHiddenDim> gate;
+  alignas(64) TensorF<kMaxBatchSize, C::kHiddenDim> hidden;
+
+  // The outputs of the early exit decoders in self-speculative decoding.
+  alignas(64) TensorF<kMaxBatchSize, C::kEmbeddingSize> early_exit;
+
+  // Output of the model.
+  alignas(64) TensorF<kMaxBatchSize, C::kTokensSize> logits;
+};